@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2014 Gary Baugh baughg@tcd.ie
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFILTER_DEBAND_H
+#define AVFILTER_DEBAND_H
+
+#include <stdint.h>
+
+/**
+ * Nearest (a) and second nearest (b) foreign label of a pixel with their
+ * chamfer distances. The guards are the labels the distances were
+ * propagated through.
+ */
+typedef struct DebandDistance {
+    int32_t  label_a;
+    int32_t  guard_a;
+    int32_t  label_b;
+    int32_t  guard_b;
+    uint16_t dist_a;
+    uint16_t dist_b;
+} DebandDistance;
+
+/**
+ * DSP functions of the deband filter.
+ */
+typedef struct DebandDSPContext {
+    /**
+     * Blend width pixels with the colours of their nearest two foreign
+     * labels: out = (1 - wb) * ((1 - wa) * c + wa * ca) + wb * cb.
+     * colour holds 4 samples (r, g, b, unused) per label, label l at
+     * colour[4 * (l - 1)]; a zero label_b means there is no second label.
+     * dst receives 3 floats per pixel.
+     */
+    void (*blend_line)(float *dst, const uint16_t *colour,
+                       const int *lbl, const DebandDistance *nearest,
+                       const float *weight_a, const float *weight_b, int width);
+
+    /**
+     * Same as blend_line with the weights rounded to 1.15 fixed point and
+     * integer arithmetic throughout; dst receives 3 rounded samples per
+     * pixel.
+     */
+    void (*blend_line_fixed)(uint16_t *dst, const uint16_t *colour,
+                             const int *lbl, const DebandDistance *nearest,
+                             const float *weight_a, const float *weight_b, int width);
+
+    /**
+     * Length of the run of symbols equal to symbol[0], at most width;
+     * width is at least 1.
+     */
+    int (*run_length)(const uint64_t *symbol, int width);
+} DebandDSPContext;
+
+void ff_deband_init_x86(DebandDSPContext *dsp);
+
+void ff_deband_blend_line_c(float *dst, const uint16_t *colour,
+                            const int *lbl, const DebandDistance *nearest,
+                            const float *weight_a, const float *weight_b, int width);
+
+void ff_deband_blend_line_fixed_c(uint16_t *dst, const uint16_t *colour,
+                                  const int *lbl, const DebandDistance *nearest,
+                                  const float *weight_a, const float *weight_b, int width);
+
+int ff_deband_run_length_c(const uint64_t *symbol, int width);
+
+#endif /* AVFILTER_DEBAND_H */
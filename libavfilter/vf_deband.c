@@ -24,21 +24,140 @@
  */
 #include "libavutil/imgutils.h"
 #include "libavutil/common.h"
+#include "libavutil/file.h"
 #include "libavutil/internal.h"
+#include "libavutil/intfloat.h"
+#include "libavutil/intreadwrite.h"
 #include "libavutil/opt.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/time.h"
 #include "avfilter.h"
 #include "internal.h"
 #include "video.h"
+#include "deband.h"
 #include "vf_deband.h"
 #include "vf_pixel_label.c"
 
+#if HAVE_PTHREADS
+#include <pthread.h>
+#elif HAVE_OS2THREADS
+#include "compat/os2threads.h"
+#elif HAVE_W32THREADS
+#include "compat/w32pthreads.h"
+#endif
+
+/**
+ * Where the three components of the input format live. Components are
+ * read in descriptor order (R,G,B or Y,U,V) into the 16-bit working image
+ * at luma resolution, chroma is replicated over its subsampled block.
+ */
+typedef struct {
+  int plane[3];
+  int step[3];         ///< bytes between horizontally adjacent samples
+  int offset[3];       ///< byte offset of the first sample
+  int hsub[3];
+  int vsub[3];
+  int depth;
+  int max_value;
+  int black_level;     ///< sample value treated as zero amplitude
+  int yuv;
+} PixelLayout;
+
+/**
+ * Pipeline stages timed per frame and exported as lavfi.deband.time.*
+ * frame metadata, in microseconds.
+ */
+enum DebandStage {
+  STAGE_DETECT,        ///< banding detector of the bypass option
+  STAGE_INGEST,        ///< packing, tile classification and change detection
+  STAGE_LABEL,
+  STAGE_DISTANCE,
+  STAGE_STAT,          ///< region areas, colours and neighbour counts
+  STAGE_EXPONENT,      ///< exponents and their row and column filters
+  STAGE_BLEND,         ///< interpolation and store
+  STAGE_NB
+};
+
+static const char *const stage_name[STAGE_NB] = {
+  "detect", "ingest", "label", "distance", "stat", "exponent", "blend"
+};
+
+/**
+ * Analysis file of the pass option, little-endian: a header of the tag,
+ * the version and the spatial_dist and kernel_size pass 1 chose last, then
+ * the pts and banding score of every frame.
+ */
+#define ANALYSIS_TAG     MKTAG('D','B','A','F')
+#define ANALYSIS_VERSION 1
+#define ANALYSIS_HEADER  16
+#define ANALYSIS_RECORD  12
+
+/**
+ * Working state of one frame in flight. Frames are handed to the lanes in
+ * turn; without pipelining the single lane runs on the filter thread, with
+ * it every lane runs its frames on a thread of its own.
+ */
+typedef struct DebandLane {
+    AVFilterContext *ctx;
+    deband_arena arena;            ///< working buffers reused across frames
+    AVFrame *in;                   ///< frame in flight, NULL when the lane is free
+    AVFrame *out;                  ///< in itself when debanded in place or passed through
+    uint32_t frame_number;         ///< dither frame number of the next stripe
+    int64_t stage_time[STAGE_NB];  ///< microseconds spent per stage on the frame
+    int64_t frame_labels;          ///< labels of the frame, summed over stripes
+    float score;                   ///< banding score of the frame
+    int64_t nb_skipped;            ///< frames passed through up to this one
+#if HAVE_THREADS
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int busy;                      ///< the thread has not finished the frame yet
+    int quit;
+    int running;                   ///< thread, lock and cond exist
+#endif
+} DebandLane;
+
 typedef struct {
     const AVClass *class;    
     float colour_dist;
+    int colour_tol;
     int spatial_dist;
     float dither_strength;
+    int seed;
     int kernel_size;
+    int temporal;
+    int analysis_scale;
+    int stripe_rows;
+    int fixed_point;
+    float bypass;
+    int pipeline;
+    int pass;
+    char *analysis_file_str;
+    int fixed;                     ///< fixed_point in effect for the input
+    int analysis_width;
+    int analysis_height;
+    int stripe_height;             ///< resolved stripe_rows, 0 for whole frames
+    int stripe_overlap;            ///< analysis rows of context above and below a stripe
+    int spatial_distance;          ///< spatial_dist resolved for the frame size, in chamfer units
+    int chosen_spatial_dist;       ///< spatial_dist chosen for the frame size, in pixels
+    int chosen_kernel_size;
+    PixelLayout layout;
+    filter_kernel exponent_kernel;
+    float_list weight_table;       ///< blend weights per chamfer distance and exponent
+    DebandDSPContext dsp;
+    DebandLane *lane;              ///< nb_lanes frames in flight
+    int nb_lanes;
+    int next_lane;                 ///< lane of the next input frame
+    uint32_t frame_number;
+    label_list detect_hist;        ///< luma histogram of the banding detector
+    int64_t nb_frames;
+    int64_t nb_skipped;            ///< frames passed through by the detector
+    FILE *analysis_file;           ///< written in pass 1
+    int analysis_header;           ///< the header of analysis_file is written
+    uint8_t *analysis;             ///< file mapped in pass 2
+    size_t analysis_size;
+    int64_t analysis_frames;       ///< frame records in analysis
+    int analysis_mismatch;         ///< a frame had no record, warned once
 } FlipContext;
 
 
@@ -46,13 +165,438 @@ static av_cold int init(AVFilterContext *ctx)
 {
   FlipContext *s = ctx->priv;
   
+  s->dsp.blend_line = ff_deband_blend_line_c;
+  s->dsp.blend_line_fixed = ff_deband_blend_line_fixed_c;
+  s->dsp.run_length = ff_deband_run_length_c;
+  
+  if (ARCH_X86)
+    ff_deband_init_x86(&s->dsp);
+  
+  if (s->pass == 1) {
+    s->analysis_file = fopen(s->analysis_file_str, "wb");
+    if (!s->analysis_file) {
+      int err = AVERROR(errno);
+      char buf[128];
+      av_strerror(err, buf, sizeof(buf));
+      av_log(ctx, AV_LOG_ERROR, "Could not open analysis file %s: %s\n",
+             s->analysis_file_str, buf);
+      return err;
+    }
+  }
+  else if (s->pass == 2) {
+    int spatial_dist, kernel_size;
+    int err = av_file_map(s->analysis_file_str, &s->analysis, &s->analysis_size, 0, ctx);
+    if (err < 0)
+      return err;
+    
+    if (s->analysis_size < ANALYSIS_HEADER || AV_RL32(s->analysis) != ANALYSIS_TAG ||
+        AV_RL32(s->analysis + 4) != ANALYSIS_VERSION ||
+        (s->analysis_size - ANALYSIS_HEADER) % ANALYSIS_RECORD) {
+      av_log(ctx, AV_LOG_ERROR, "%s is not a deband analysis file.\n", s->analysis_file_str);
+      return AVERROR_INVALIDDATA;
+    }
+    
+    // the recorded parameters must be valid option values
+    spatial_dist = (int32_t)AV_RL32(s->analysis + 8);
+    kernel_size  = (int32_t)AV_RL32(s->analysis + 12);
+    if (spatial_dist < -1 || spatial_dist > 40 || kernel_size < -1 || kernel_size > 9) {
+      av_log(ctx, AV_LOG_ERROR, "Invalid spatial_dist %d or kernel_size %d in %s.\n",
+             spatial_dist, kernel_size, s->analysis_file_str);
+      return AVERROR_INVALIDDATA;
+    }
+    s->analysis_frames = (s->analysis_size - ANALYSIS_HEADER) / ANALYSIS_RECORD;
+  }
+  
   return 0;
 }
 
+static void process_lane(AVFilterContext *ctx, DebandLane *lane);
+static int flush_lanes(AVFilterContext *ctx);
+
+#if HAVE_THREADS
+static void *lane_worker(void *arg)
+{
+    DebandLane *lane = arg;
+
+    pthread_mutex_lock(&lane->lock);
+    for (;;) {
+        while (!lane->busy && !lane->quit)
+            pthread_cond_wait(&lane->cond, &lane->lock);
+        if (lane->quit)
+            break;
+        pthread_mutex_unlock(&lane->lock);
+
+        process_lane(lane->ctx, lane);
+
+        pthread_mutex_lock(&lane->lock);
+        lane->busy = 0;
+        pthread_cond_signal(&lane->cond);
+    }
+    pthread_mutex_unlock(&lane->lock);
+
+    return NULL;
+}
+#endif
+
+static void free_lanes(FlipContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_lanes; i++) {
+        DebandLane *lane = &s->lane[i];
+
+#if HAVE_THREADS
+        if (lane->running) {
+            pthread_mutex_lock(&lane->lock);
+            lane->quit = 1;
+            pthread_cond_signal(&lane->cond);
+            pthread_mutex_unlock(&lane->lock);
+            pthread_join(lane->thread, NULL);
+            pthread_mutex_destroy(&lane->lock);
+            pthread_cond_destroy(&lane->cond);
+        }
+#endif
+        if (lane->out != lane->in)
+            av_frame_free(&lane->out);
+        av_frame_free(&lane->in);
+        free_arena(&lane->arena);
+    }
+    av_freep(&s->lane);
+    s->nb_lanes = 0;
+}
+
+/**
+ * Allocate nb_lanes lanes for width x height analysis frames and start
+ * their threads when there is more than one.
+ */
+static int allocate_lanes(AVFilterContext *ctx, int nb_lanes, size_t width, size_t height)
+{
+    FlipContext *s = ctx->priv;
+    int i, ret;
+
+    s->lane = av_calloc(nb_lanes, sizeof(*s->lane));
+    if (!s->lane)
+        return AVERROR(ENOMEM);
+    s->nb_lanes = nb_lanes;
+    s->next_lane = 0;
+
+    for (i = 0; i < nb_lanes; i++) {
+        DebandLane *lane = &s->lane[i];
+
+        lane->ctx = ctx;
+        // the lanes of a pipeline run their slices one after another
+        ret = allocate_arena(&lane->arena, width, height, nb_lanes > 1 ? 1 : ctx->graph->nb_threads, s->fixed);
+        if (ret < 0)
+            goto fail;
+
+        if (s->colour_tol) {
+            allocate_symbol(&lane->arena.raw_symbol, width * height);
+            if (!lane->arena.raw_symbol.data_ptr) {
+                ret = AVERROR(ENOMEM);
+                goto fail;
+            }
+        }
+
+        if (s->temporal) {
+            allocate_symbol(&lane->arena.prev_symbol, width * height);
+            if (!lane->arena.prev_symbol.data_ptr) {
+                ret = AVERROR(ENOMEM);
+                goto fail;
+            }
+        }
+
+#if HAVE_THREADS
+        if (nb_lanes > 1) {
+            pthread_mutex_init(&lane->lock, NULL);
+            pthread_cond_init(&lane->cond, NULL);
+            ret = pthread_create(&lane->thread, NULL, lane_worker, lane);
+            if (ret) {
+                pthread_mutex_destroy(&lane->lock);
+                pthread_cond_destroy(&lane->cond);
+                ret = AVERROR(ret);
+                goto fail;
+            }
+            lane->running = 1;
+        }
+#endif
+    }
+
+    return 0;
+
+fail:
+    // a filter left without lanes refuses frames instead of using them
+    free_lanes(s);
+    return ret;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+  FlipContext *s = ctx->priv;
+  
+  if (s->bypass > 0.0f && s->nb_frames)
+    av_log(ctx, AV_LOG_INFO, "%"PRId64" of %"PRId64" frames passed through by the banding detector\n",
+           s->nb_skipped, s->nb_frames);
+  
+  free_label(&s->detect_hist);
+  free_lanes(s);
+  if (s->analysis_file && fclose(s->analysis_file))
+    av_log(ctx, AV_LOG_ERROR, "Could not write analysis file %s\n", s->analysis_file_str);
+  if (s->analysis)
+    av_file_unmap(s->analysis, s->analysis_size);
+  free_kernel(&s->exponent_kernel);
+  free_float(&s->weight_table);
+}
+
+static void set_pixel_layout(PixelLayout *layout, const AVPixFmtDescriptor *desc)
+{
+    int c;
+
+    for (c = 0; c < 3; c++) {
+        layout->plane[c]  = desc->comp[c].plane;
+        layout->step[c]   = desc->comp[c].step_minus1 + 1;
+        layout->offset[c] = desc->comp[c].offset_plus1 - 1;
+        layout->hsub[c]   = c ? desc->log2_chroma_w : 0;
+        layout->vsub[c]   = c ? desc->log2_chroma_h : 0;
+    }
+
+    layout->depth       = desc->comp[0].depth_minus1 + 1;
+    layout->max_value   = (1 << layout->depth) - 1;
+    layout->yuv         = !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+    layout->black_level = layout->yuv ? 16 << (layout->depth - 8) : 0;
+}
+
+/**
+ * Append size bytes to the pass 1 analysis file and flush them. A short
+ * write would leave a file pass 2 rejects or misreads, so it fails the
+ * filter on the frame it happens.
+ */
+static int analysis_write(AVFilterContext *ctx, const uint8_t *data, size_t size)
+{
+    FlipContext *s = ctx->priv;
+
+    if (fwrite(data, 1, size, s->analysis_file) != size || fflush(s->analysis_file)) {
+        int err = errno ? AVERROR(errno) : AVERROR(EIO);
+        char buf[128];
+        av_strerror(err, buf, sizeof(buf));
+        av_log(ctx, AV_LOG_ERROR, "Could not write analysis file %s: %s\n",
+               s->analysis_file_str, buf);
+        return err;
+    }
+
+    return 0;
+}
+
+/**
+ * Write the analysis file header with the chosen parameters, over the
+ * previous one when there is one already; only then does the file have
+ * to be seekable.
+ */
+static int write_analysis_header(AVFilterContext *ctx)
+{
+    FlipContext *s = ctx->priv;
+    uint8_t header[ANALYSIS_HEADER];
+    long pos = 0;
+    int ret;
+
+    if (s->analysis_header) {
+        pos = ftell(s->analysis_file);
+        if (pos < 0 || fseek(s->analysis_file, 0, SEEK_SET))
+            goto fail;
+    }
+
+    AV_WL32(header,      ANALYSIS_TAG);
+    AV_WL32(header + 4,  ANALYSIS_VERSION);
+    AV_WL32(header + 8,  s->chosen_spatial_dist);
+    AV_WL32(header + 12, s->chosen_kernel_size);
+    ret = analysis_write(ctx, header, sizeof(header));
+    if (ret < 0)
+        return ret;
+    s->analysis_header = 1;
+
+    if (pos && fseek(s->analysis_file, pos, SEEK_SET))
+        goto fail;
+
+    return 0;
+
+fail:
+    ret = errno ? AVERROR(errno) : AVERROR(EIO);
+    av_log(ctx, AV_LOG_ERROR, "Could not seek in analysis file %s\n",
+           s->analysis_file_str);
+    return ret;
+}
+
+/**
+ * Resolve spatial_dist and kernel_size for the input size, rebuilding the
+ * exponent kernel and the weight table only when their size changed.
+ */
+static int config_params(AVFilterContext *ctx)
+{
+    FlipContext *flip = ctx->priv;
+    const int w = ctx->inputs[0]->w;
+    int spatial_distance = flip->spatial_dist;
+    int kern_size = flip->kernel_size;
+    int changed;
+
+    if(spatial_distance < 0) {
+      if(w > 1200) {
+        spatial_distance = 13;
+      }
+      else if(w > 720) {
+        spatial_distance = 7;
+      }
+      else {
+        spatial_distance = 3;
+      }
+    }
+
+    if(kern_size < 0) {
+      if(w > 1200) {
+        kern_size = 7;
+      }
+      else if(w > 720) {
+        kern_size = 5;
+      }
+      else {
+        kern_size = 3;
+      }
+    }
+    // pass 2 takes the values pass 1 chose for its input
+    if (flip->pass == 2) {
+        if (flip->spatial_dist < 0)
+            spatial_distance = (int32_t)AV_RL32(flip->analysis + 8);
+        if (flip->kernel_size < 0)
+            kern_size = (int32_t)AV_RL32(flip->analysis + 12);
+    }
+
+    // odd and at least 3 taps, as set_kernel_size() makes it
+    kern_size = FFMAX(kern_size, 3) | 1;
+    changed = flip->chosen_spatial_dist != spatial_distance ||
+              flip->chosen_kernel_size != kern_size;
+    flip->chosen_spatial_dist = spatial_distance;
+    flip->chosen_kernel_size = kern_size;
+
+    // the analysis runs on every analysis_scale-th pixel of every
+    // analysis_scale-th row, distances shrink with it
+    spatial_distance = FFMAX((spatial_distance + flip->analysis_scale/2) / flip->analysis_scale, 1);
+
+    if (!flip->exponent_kernel.kernel.data_ptr || flip->exponent_kernel.size != kern_size) {
+        free_kernel(&flip->exponent_kernel);
+        set_kernel_size(kern_size, &flip->exponent_kernel);
+        if (!flip->exponent_kernel.kernel.data_ptr)
+            return AVERROR(ENOMEM);
+    }
+
+    if (!flip->weight_table.data_ptr ||
+        flip->spatial_distance != spatial_distance * (int)spatial_dist_scale) {
+        flip->spatial_distance = spatial_distance * (int)spatial_dist_scale;
+        free_float(&flip->weight_table);
+        set_weight_table(flip->spatial_distance, &flip->weight_table);
+        if (!flip->weight_table.data_ptr)
+            return AVERROR(ENOMEM);
+    }
+
+    // stripes see every region and distance reaching their rows, but only
+    // the part of a region within the stripe: its area and, with
+    // colour_tol, its mean colour depend on where the stripe cuts it. Even
+    // row counts keep stripes on chroma rows
+    flip->stripe_overlap = FFALIGN(spatial_distance + kern_size/2 + 1, 2);
+
+    // pass 2 applies the header to the whole input, so it follows commands
+    // and reconfiguration
+    if (flip->analysis_file && (changed || !flip->analysis_header))
+        return write_analysis_header(ctx);
+
+    return 0;
+}
+
+/**
+ * (Re)allocate the lanes when their number, the rows of a stripe and its
+ * context or the fixed point path changed. Frames in flight are lost,
+ * flush them first.
+ */
+static int config_lanes(AVFilterContext *ctx, int nb_lanes)
+{
+    FlipContext *flip = ctx->priv;
+    const size_t width = flip->analysis_width;
+    size_t height = flip->analysis_height;
+
+    if (flip->stripe_height)
+        height = FFMIN(flip->stripe_height + 2*flip->stripe_overlap, height);
+
+    if (flip->nb_lanes != nb_lanes ||
+        flip->lane[0].arena.width != width || flip->lane[0].arena.height != height ||
+        !flip->lane[0].arena.dst_list.data_ptr != flip->fixed) {
+        free_lanes(flip);
+        return allocate_lanes(ctx, nb_lanes, width, height);
+    }
+
+    return 0;
+}
+
 static int config_input(AVFilterLink *link)
 {
     FlipContext *flip = link->dst->priv;
-    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(link->format);
+    const size_t width = (link->w + flip->analysis_scale - 1) / flip->analysis_scale;
+    const size_t height = (link->h + flip->analysis_scale - 1) / flip->analysis_scale;
+    int nb_lanes, ret;
+
+    set_pixel_layout(&flip->layout, av_pix_fmt_desc_get(link->format));
+
+    ret = config_params(link->dst);
+    if (ret < 0)
+        return ret;
+
+    flip->analysis_width = width;
+    flip->analysis_height = height;
+
+    flip->stripe_height = FFALIGN(flip->stripe_rows, 2);
+    if (flip->stripe_height >= height)
+        flip->stripe_height = 0;
+
+    if (flip->stripe_height && flip->temporal) {
+        av_log(link->dst, AV_LOG_WARNING, "temporal is not supported with stripe_rows, disabling it.\n");
+        flip->temporal = 0;
+    }
+
+    // the fixed point path writes every pixel straight to its samples
+    flip->fixed = flip->fixed_point;
+    if (flip->fixed && (flip->analysis_scale > 1 || flip->temporal ||
+                        flip->layout.hsub[1] || flip->layout.vsub[1])) {
+        av_log(link->dst, AV_LOG_WARNING, "fixed_point needs analysis_scale=1, no temporal "
+               "and no chroma subsampling, using the float path.\n");
+        flip->fixed = 0;
+    }
+
+    nb_lanes = FFMAX(flip->pipeline, 1);
+    if (nb_lanes > 1 && flip->temporal) {
+        av_log(link->dst, AV_LOG_WARNING, "temporal needs the previous frame, disabling pipeline.\n");
+        nb_lanes = 1;
+    }
+    if (nb_lanes > 1 && !HAVE_THREADS) {
+        av_log(link->dst, AV_LOG_WARNING, "pipeline needs threads, disabling it.\n");
+        nb_lanes = 1;
+    }
+    // the first frames of a pipeline only fill it
+    if (nb_lanes > 1)
+        link->dst->outputs[0]->flags |= FF_LINK_FLAG_REQUEST_LOOP;
+
+    // frames in flight leave before the lanes are resized under them
+    if (flip->nb_lanes) {
+        ret = flush_lanes(link->dst);
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = config_lanes(link->dst, nb_lanes);
+    if (ret < 0)
+        return ret;
+
+    if (flip->bypass > 0.0f || flip->pass == 1) {
+        free_label(&flip->detect_hist);
+        allocate_label(&flip->detect_hist, flip->layout.max_value + 1);
+        if (!flip->detect_hist.data_ptr)
+            return AVERROR(ENOMEM);
+    }
 
     return 0;
 }
@@ -61,6 +605,10 @@ static int query_formats(AVFilterContext *ctx)
 {
   static const enum AVPixelFormat pix_fmts[] = {
     AV_PIX_FMT_RGB24,
+    AV_PIX_FMT_GBRP,     AV_PIX_FMT_GBRP10,    AV_PIX_FMT_GBRP12,    AV_PIX_FMT_GBRP16,
+    AV_PIX_FMT_YUV420P,  AV_PIX_FMT_YUV420P10, AV_PIX_FMT_YUV420P12, AV_PIX_FMT_YUV420P16,
+    AV_PIX_FMT_YUV422P,  AV_PIX_FMT_YUV422P10, AV_PIX_FMT_YUV422P12, AV_PIX_FMT_YUV422P16,
+    AV_PIX_FMT_YUV444P,  AV_PIX_FMT_YUV444P10, AV_PIX_FMT_YUV444P12, AV_PIX_FMT_YUV444P16,
     AV_PIX_FMT_NONE
   };
   
@@ -81,137 +629,258 @@ static AVFrame *get_video_buffer(AVFilterLink *link, int w, int h)
  
     return frame;
 }
-static inline float rand_float() {
-  size_t v = rand()%10000;
-  float rfn = (float)v;
-  rfn /= 10000;
-  
-  return rfn;
+void ff_deband_blend_line_c(float *dst, const uint16_t *colour,
+                            const int *lbl, const DebandDistance *nearest,
+                            const float *weight_a, const float *weight_b, int width)
+{
+    int x, c;
+
+    for (x = 0; x < width; x++) {
+        const uint16_t *colour_ptr   = colour + 4 * (lbl[x]   - 1);
+        const uint16_t *colour_a_ptr = nearest[x].label_a ?
+                                       colour + 4 * (nearest[x].label_a - 1) : colour_ptr;
+        float wght_alpha = weight_a[x];
+        float wght_beta  = 1.0f - wght_alpha;
+
+        for (c = 0; c < 3; c++)
+            dst[c] = wght_beta * colour_ptr[c] + wght_alpha * colour_a_ptr[c];
+
+        if (nearest[x].label_b > 0) {
+            const uint16_t *colour_b_ptr = colour + 4 * (nearest[x].label_b - 1);
+
+            wght_alpha = weight_b[x];
+            wght_beta  = 1.0f - wght_alpha;
+
+            for (c = 0; c < 3; c++)
+                dst[c] = wght_beta * dst[c] + wght_alpha * colour_b_ptr[c];
+        }
+
+        dst += 3;
+    }
 }
 
-static void deband_frame(uint8_t *dstrow, uint8_t *srcrow, FrameInfo* frame_info,FlipContext *context) {  
-  const float spatial_dist_scale = 5.0f;
-   
-  size_t offset = 0;
-  size_t i,j;
-  size_t _max_label = 0;
-  uint8_t* output_ptr = dstrow;
-  const size_t pixel_count = frame_info->height*frame_info->width;
-  const size_t src_stride = frame_info->width*3;
-  int spatial_distance = context->spatial_dist;
+void ff_deband_blend_line_fixed_c(uint16_t *dst, const uint16_t *colour,
+                                  const int *lbl, const DebandDistance *nearest,
+                                  const float *weight_a, const float *weight_b, int width)
+{
+    int x, c;
+
+    for (x = 0; x < width; x++) {
+        const uint16_t *colour_ptr   = colour + 4 * (lbl[x]   - 1);
+        const uint16_t *colour_a_ptr = nearest[x].label_a ?
+                                       colour + 4 * (nearest[x].label_a - 1) : colour_ptr;
+        const int64_t wght_alpha = lrintf(weight_a[x] * (1 << 15));
+        int64_t value[3];
+
+        // 16.15
+        for (c = 0; c < 3; c++)
+            value[c] = ((1 << 15) - wght_alpha) * colour_ptr[c] + wght_alpha * colour_a_ptr[c];
+
+        if (nearest[x].label_b > 0) {
+            const uint16_t *colour_b_ptr = colour + 4 * (nearest[x].label_b - 1);
+            const int64_t wght_beta = lrintf(weight_b[x] * (1 << 15));
+
+            for (c = 0; c < 3; c++)
+                dst[c] = (((1 << 15) - wght_beta) * value[c] +
+                          (wght_beta * colour_b_ptr[c] << 15) + (1 << 29)) >> 30;
+        } else {
+            for (c = 0; c < 3; c++)
+                dst[c] = (value[c] + (1 << 14)) >> 15;
+        }
+
+        dst += 3;
+    }
+}
+
+int ff_deband_run_length_c(const uint64_t *symbol, int width)
+{
+    int x = 1;
+
+    while (x < width && symbol[x] == symbol[0])
+        x++;
+
+    return x;
+}
+
+/**
+ * Dither generator state for one row of one frame. Each row gets its own
+ * xorshift stream derived from the seed, so the output does not depend on
+ * the slice count and needs no shared state between threads.
+ */
+static inline uint32_t dither_rng_init(uint32_t seed, uint32_t frame, uint32_t row) {
+  uint32_t state = seed * 0x9E3779B9U ^ frame * 0x85EBCA6BU ^ row * 0xC2B2AE35U;
   
-  const float colour_distance = context->colour_dist * context->colour_dist;
-  const float dither_strength = context->dither_strength;
-  int kern_size = context->kernel_size;
+  // murmur3 finaliser, spreads neighbouring rows apart
+  state ^= state >> 16;
+  state *= 0x85EBCA6BU;
+  state ^= state >> 13;
+  state *= 0xC2B2AE35U;
+  state ^= state >> 16;
   
-  if(spatial_distance < 0) {
-    if(frame_info->width > 1200) {
-      spatial_distance = 13;
-    }
-    else if(frame_info->width > 720) {
-      spatial_distance = 7;
-    }
-    else {
-      spatial_distance = 3;
-    }
-  }
+  return state ? state : 0x6D2B79F5U;
+}
+
+/** uniform in [0,1) */
+static inline float rand_float(uint32_t *state) {
+  uint32_t x = *state;
   
-  if(kern_size < 0) {
-    if(frame_info->width > 1200) {
-      kern_size = 7;
-    }
-    else if(frame_info->width > 720) {
-      kern_size = 5;
-    }
-    else {
-      kern_size = 3;
-    }
-  }
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
   
-  spatial_distance *= (int)spatial_dist_scale;
-    
-  pixel_list src_image;
-  label_list block_label;
-  allocate_pixel(&src_image,pixel_count*3);  
-  allocate_label(&block_label,pixel_count);
+  return (x >> 8) * (1.0f / (1 << 24));
+}
+
+typedef struct ThreadData {
+  FrameInfo *frame_info;
+  const PixelLayout *layout;
+  bsymbol* symbol_ptr;
+  const bsymbol* prev_symbol_ptr;
+  label_table *table;
+  blabel* label_ptr;
+  DebandDistance* distance_ptr;
+  const region_list* region;
+  RGB_colour* block_colour;
+  p_float* exponent_a_ptr;
+  p_float* exponent_b_ptr;
+  p_float* filtered_a_ptr;
+  p_float* filtered_b_ptr;
+  p_float* interp_out_ptr;
+  uint8_t* run_count;
+  uint8_t* row_diff;
+  const uint8_t* tile_flat;
+  const uint8_t* tile_todo;
+  size_t tile_cols;
+  avfilter_action_func *store;
+  pixel* row_buffer;
+  blend_stat* slice_stat;
+  int fixed;
+  filter_kernel *exponent_kernel;
+  const p_float* weight_table;
+  const DebandDSPContext *dsp;
+  p_float colour_distance;
+  p_float dither_strength;
+  uint32_t seed;
+  uint32_t frame_number;
+  int spatial_distance;
+  int colour_tolerance;
+  int64_t amplitude_unit;
+} ThreadData;
+
+/**
+ * Low amplitude colours (black) are never blended. For RGB this is the
+ * squared length of the colour, for YUV the squared luma above black.
+ */
+static inline int64_t colour_amplitude(const RGB_colour *colour, const PixelLayout *layout) {
+  if(layout->yuv) {
+    int64_t luma = FFMAX(colour->r - layout->black_level, 0);
+    return luma * luma;
+  }
   
-  uint8_t* pel_row = ( uint8_t*)src_image.data_ptr;
+  return (int64_t)colour->r * colour->r + (int64_t)colour->g * colour->g + (int64_t)colour->b * colour->b;
+}
+
+/**
+ * Pack a slice of the input frame planes into symbols, count their colour
+ * runs for the tile classification and in temporal mode compare them with
+ * the previous frame.
+ */
+static int ingest_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+  ThreadData *td = arg;
+  const size_t height = td->frame_info->height;
+  const size_t width = td->frame_info->width;
+  const size_t slice_start = (height *  jobnr   ) / nb_jobs;
+  const size_t slice_end   = (height * (jobnr+1)) / nb_jobs;
+  const PixelLayout *layout = td->layout;
+  const int scale = td->frame_info->scale;
+  bsymbol* sym = td->symbol_ptr + slice_start*width;
   
-  for (i = 0; i < frame_info->height; i++) {        
-    uint8_t *pel = pel_row;
-    uint8_t *src = srcrow;
+  for (size_t i = slice_start; i < slice_end; i++) {
+    const uint8_t* row[3];
     
-    for (j = 0; j < frame_info->width; j++) {
-      offset = 3*j;   
-      
-      pel[offset + 0] = src[offset + 0];
-      pel[offset + 1] = src[offset + 1];
-      pel[offset + 2] = src[offset + 2];
-      
-    }    
+    for (int c = 0; c < 3; c++)
+      row[c] = td->frame_info->src_data[layout->plane[c]] + layout->offset[c] +
+	(i*scale >> layout->vsub[c]) * td->frame_info->src_stride[layout->plane[c]];
     
-    srcrow += frame_info->src_stride;
-    pel_row += src_stride;
+    if(layout->depth > 8) {
+      for (size_t j = 0; j < width; j++) {
+	*sym++ = AV_RN16(row[0] + (j*scale >> layout->hsub[0])*layout->step[0]) |
+	  (bsymbol)AV_RN16(row[1] + (j*scale >> layout->hsub[1])*layout->step[1]) << 16 |
+	  (bsymbol)AV_RN16(row[2] + (j*scale >> layout->hsub[2])*layout->step[2]) << 32;
+      }
+    }
+    else {
+      for (size_t j = 0; j < width; j++) {
+	*sym++ = row[0][(j*scale >> layout->hsub[0])*layout->step[0]] |
+	  (bsymbol)row[1][(j*scale >> layout->hsub[1])*layout->step[1]] << 16 |
+	  (bsymbol)row[2][(j*scale >> layout->hsub[2])*layout->step[2]] << 32;
+      }
+    }
   }
   
-  label_list_collection min_field;
-  rgb_colour_list block_colour_list;
+  tile_runs(td->symbol_ptr,width,slice_start,slice_end,td->colour_tolerance,td->run_count,td->tile_cols);
   
+  if(td->prev_symbol_ptr)
+    tile_diff(td->symbol_ptr,td->prev_symbol_ptr,width,slice_start,slice_end,td->row_diff,td->tile_cols);
+  return 0;
+}
+
+/**
+ * Apply the colour tolerance to the input symbols, when set, and label
+ * the slice.
+ */
+static int label_frame_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+  ThreadData *td = arg;
+  const size_t height = td->frame_info->height;
+  const size_t width = td->frame_info->width;
+  const size_t slice_start = (height *  jobnr   ) / nb_jobs;
+  const size_t slice_end   = (height * (jobnr+1)) / nb_jobs;
+  label_list block_label = { td->label_ptr, height*width };
   
-  allocate_collection(&min_field,pixel_count); 
+  if(td->colour_tolerance)
+    tolerant_slice(td->symbol_ptr,height,width,slice_start,slice_end,td->colour_tolerance,td->table->symbol.data_ptr);
   
- 
-  label(src_image.data_ptr,frame_info->height,frame_info->width,&block_label,&_max_label);
-  label_distance(frame_info->height,frame_info->width,&block_label,_max_label,&min_field);
+  label_slice(width,slice_start,slice_end,jobnr,td->table,&block_label,td->dsp->run_length);
+  return 0;
+}
+
+static int resolve_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+  ThreadData *td = arg;
+  const size_t height = td->frame_info->height;
+  const size_t width = td->frame_info->width;
+  label_list block_label = { td->label_ptr, height*width };
   
-  allocate_colour(&block_colour_list,_max_label);
-  label_stat(src_image.data_ptr,frame_info->height,frame_info->width,&block_label,_max_label,&block_colour_list);
+  label_resolve(width,(height * jobnr) / nb_jobs,(height * (jobnr+1)) / nb_jobs,td->table,&block_label);
+  return 0;
+}
+
+static int exponent_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+  ThreadData *td = arg;
+  const size_t height = td->frame_info->height;
+  const size_t width = td->frame_info->width;
+  const size_t p_start = (height *  jobnr   ) / nb_jobs * width;
+  const size_t p_end   = (height * (jobnr+1)) / nb_jobs * width;
   
-  // interpolation
-  label_list hist_label_a; //(max_label+1);
-  label_list hist_label_b; //(max_label+1);
-  label_list hist_label; //(max_label+1);
-  float_list exponent_a; //(pixel_count);
-  float_list exponent_b; //(pixel_count);
-  float_list dst_list;
-  RGB_colour* block_colour = block_colour_list.data_ptr;
-  
-  allocate_float(&dst_list,pixel_count*3);
-  allocate_float(&exponent_a,pixel_count);
-  allocate_float(&exponent_b,pixel_count);
-  allocate_label(&hist_label_a,_max_label+1);
-  allocate_label(&hist_label_b,hist_label_a.size);
-  allocate_label(&hist_label,hist_label_a.size);
-  
-  p_float* dst_ptr = dst_list.data_ptr;
-  p_float* interp_out_ptr = dst_ptr;
-  
-  p_float* exponent_a_ptr = exponent_a.data_ptr;
-  p_float* exponent_b_ptr = exponent_b.data_ptr;
-  
-  blabel* min_dist_a_ptr = min_field.data_ptr1;
-  blabel* min_dist_b_ptr = min_field.data_ptr3;
-  blabel* label_a_ptr = min_field.data_ptr0;
-  blabel* label_b_ptr = min_field.data_ptr2;
-  blabel* label_ptr = block_label.data_ptr;
-  
-  label_histogram(label_a_ptr,&hist_label_a,pixel_count);
-  label_histogram(label_b_ptr,&hist_label_b,pixel_count);
-  label_histogram(label_ptr,&hist_label,pixel_count);
-  
-  blabel* lbl_a_ptr = label_a_ptr; // closest colour label
-  blabel* lbl_b_ptr = label_b_ptr; // 2nd closest colour label
-  blabel* lbl_ptr = label_ptr; // colour label
-  p_float* exp_a_ptr = exponent_a_ptr;
-  p_float* exp_b_ptr = exponent_b_ptr;
+  DebandDistance* near_ptr = td->distance_ptr + p_start; // closest and 2nd closest colour label
+  blabel* lbl_ptr = td->label_ptr + p_start; // colour label
+  p_float* exp_a_ptr = td->exponent_a_ptr + p_start;
+  p_float* exp_b_ptr = td->exponent_b_ptr + p_start;
+  const blabel* area = td->region->area.data_ptr;
+  const blabel* near_a = td->region->near_a.data_ptr;
+  const blabel* near_b = td->region->near_b.data_ptr;
   blabel lbl_a = 0;
   blabel lbl_b = 0;
   blabel lbl = 0;
   
-  for(size_t p = 0; p < pixel_count; p++) {
-    lbl_a = hist_label_a.data_ptr[*lbl_a_ptr];
-    lbl_b = hist_label_b.data_ptr[*lbl_b_ptr];
-    lbl = hist_label.data_ptr[*lbl_ptr];
+  for(size_t p = p_start; p < p_end; p++) {
+    lbl_a = near_a[near_ptr->label_a];
+    lbl_b = near_b[near_ptr->label_b];
+    lbl = area[*lbl_ptr];
     
     *exp_a_ptr = 0.25f * (p_float)lbl_a / (p_float)lbl;
     *exp_b_ptr = 0.25f * (p_float)lbl_b / (p_float)lbl;
@@ -224,240 +893,1018 @@ static void deband_frame(uint8_t *dstrow, uint8_t *srcrow, FrameInfo* frame_info
     
     exp_a_ptr++;
     exp_b_ptr++;
-    lbl_a_ptr++;
-    lbl_b_ptr++;
+    near_ptr++;
     lbl_ptr++;
   }
-  size_t kernel_size = kern_size;
-  filter_kernel exponent_kernel_2d;
-  
-  set_kernel_size(kernel_size, &exponent_kernel_2d);
-
-  filter_exponent(frame_info->height,frame_info->width,&exponent_a,&exponent_kernel_2d);
-  filter_exponent(frame_info->height,frame_info->width,&exponent_b,&exponent_kernel_2d);
-  exp_a_ptr = exponent_a_ptr;
-  exp_b_ptr = exponent_b_ptr;
-  blabel* ma_ptr = min_dist_a_ptr;
-  blabel* mb_ptr = min_dist_b_ptr;
-  lbl_ptr = label_ptr;
-  lbl_a_ptr = label_a_ptr;
-  lbl_b_ptr = label_b_ptr;
+  return 0;
+}
+
+static int filter_rows_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+  ThreadData *td = arg;
+  const size_t height = td->frame_info->height;
+  const size_t width = td->frame_info->width;
+  const size_t slice_start = (height *  jobnr   ) / nb_jobs;
+  const size_t slice_end   = (height * (jobnr+1)) / nb_jobs;
+  
+  filter_exponent_rows(height,width,slice_start,slice_end,td->exponent_a_ptr,td->filtered_a_ptr,td->exponent_kernel);
+  filter_exponent_rows(height,width,slice_start,slice_end,td->exponent_b_ptr,td->filtered_b_ptr,td->exponent_kernel);
+  return 0;
+}
+
+static int filter_columns_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+  ThreadData *td = arg;
+  const size_t height = td->frame_info->height;
+  const size_t width = td->frame_info->width;
+  const size_t slice_start = (height *  jobnr   ) / nb_jobs;
+  const size_t slice_end   = (height * (jobnr+1)) / nb_jobs;
+  
+  filter_exponent_columns(height,width,slice_start,slice_end,td->filtered_a_ptr,td->exponent_a_ptr,td->exponent_kernel);
+  filter_exponent_columns(height,width,slice_start,slice_end,td->filtered_b_ptr,td->exponent_b_ptr,td->exponent_kernel);
+  return 0;
+}
+
+/**
+ * Fixed point path: write pixels [x0, x1) of row y, given as 16-bit
+ * samples, or with rgb_ptr NULL the input samples, to the output planes.
+ * Rows outside the stored range of a stripe are left alone.
+ */
+static void write_span(const FrameInfo *frame_info, const PixelLayout *layout,
+		       size_t y, size_t x0, size_t x1, const pixel* rgb_ptr)
+{
+  if(y < frame_info->store_start || y >= frame_info->store_end)
+    return;
+  
+  if(!rgb_ptr && frame_info->src_data[0] == frame_info->dst_data[0])
+    return;
+  
+  for (int c = 0; c < 3; c++) {
+    const int step = layout->step[c];
+    const int p = layout->plane[c];
+    const uint8_t* src = frame_info->src_data[p] + layout->offset[c] + y*frame_info->src_stride[p] + x0*step;
+    uint8_t* dst = frame_info->dst_data[p] + layout->offset[c] + y*frame_info->dst_stride[p] + x0*step;
+    const pixel* pel = rgb_ptr + c;
+    
+    for (size_t x = x0; x < x1; x++, src += step, dst += step) {
+      if(!rgb_ptr) {
+	dst[0] = src[0];
+	if(layout->depth > 8)
+	  dst[1] = src[1];
+	continue;
+      }
+      
+      if(layout->depth > 8)
+	AV_WN16(dst, *pel);
+      else
+	*dst = *pel;
+      pel += 3;
+    }
+  }
+}
+
+/**
+ * Account one blended pixel with its largest component change.
+ */
+static inline void blend_correction(blend_stat *stat, const RGB_colour *colour,
+                                    const RGB_colour *colour_a, const RGB_colour *colour_b,
+                                    p_float weight_a, p_float weight_b, p_float step) {
+  const p_float ka = (1.0f - weight_b) * weight_a;
+  p_float dr = ka * ((p_float)colour_a->r - colour->r);
+  p_float dg = ka * ((p_float)colour_a->g - colour->g);
+  p_float db = ka * ((p_float)colour_a->b - colour->b);
+  p_float correction;
+  
+  if(colour_b) {
+    dr += weight_b * ((p_float)colour_b->r - colour->r);
+    dg += weight_b * ((p_float)colour_b->g - colour->g);
+    db += weight_b * ((p_float)colour_b->b - colour->b);
+  }
+  
+  correction = FFMAX3(fabsf(dr), fabsf(dg), fabsf(db)) * step;
+  stat->blended++;
+  stat->correction_sum += correction;
+  stat->correction_max = FFMAX(stat->correction_max, correction);
+}
+
+/**
+ * Blend weights of the nearest (a) and second nearest (b) foreign label
+ * for rows of the slice, written over the filtered exponents; a weight of 0
+ * leaves the pixel alone. The blend itself is done by the DSP function.
+ */
+static int interpolate_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+  ThreadData *td = arg;
+  FrameInfo *frame_info = td->frame_info;
+  const size_t slice_start = (frame_info->height *  jobnr   ) / nb_jobs;
+  const size_t slice_end   = (frame_info->height * (jobnr+1)) / nb_jobs;
+  const size_t width = frame_info->width;
+  const p_float colour_distance = td->colour_distance;
+  const p_float dither_strength = td->dither_strength;
+  const int spatial_distance = td->spatial_distance;
+  const int64_t amplitude_unit = td->amplitude_unit;
+  const p_float* weight_table = td->weight_table;
+  RGB_colour* block_colour = td->block_colour;
+  blend_stat* stat = &td->slice_stat[jobnr];
+  const p_float step = 1.0f / (1 << (td->layout->depth - 8));
+  
+  p_float* exp_a_ptr;
+  p_float* exp_b_ptr;
+  DebandDistance* near_ptr;
+  blabel* lbl_ptr;
   RGB_colour* colour_ptr;
   RGB_colour* colour_a_ptr;
   RGB_colour* colour_b_ptr;
+  blabel lbl_a = 0;
+  blabel lbl_b = 0;
+  blabel lbl = 0;
   
-  p_float* io_ptr = interp_out_ptr;
-  
-  for(size_t p = 0; p < pixel_count; p++) {
-    lbl = *lbl_ptr;
-    lbl_a = *lbl_a_ptr;
-    lbl_b = *lbl_b_ptr;
-    f_RGB_colour out_colour;
-    p_float wght_alpha = 0.0f;
-    p_float wght_beta = 1.0f;
-    p_float dist_a = 0.0f;
-    p_float dist_b = 0.0f;
+  for(size_t y = slice_start; y < slice_end; y++) {
+    const uint8_t* flat_ptr = td->tile_todo + y / TILE_SIZE * td->tile_cols;
+    const uint8_t* tile_flat_ptr = td->tile_flat + y / TILE_SIZE * td->tile_cols;
+    uint32_t rng = dither_rng_init(td->seed,td->frame_number,frame_info->row_offset + y);
+    // rows of the stripe overlap are counted by their own stripe
+    const int counted = y*frame_info->scale >= frame_info->store_start &&
+                        y*frame_info->scale < frame_info->store_end;
+    size_t x0 = 0;
     
-    colour_ptr = &block_colour[lbl-1];
-    colour_a_ptr = &block_colour[lbl_a-1];
-    colour_b_ptr = NULL;
+    // spans of tiles to blend; textured tiles are copied through by
+    // store_slice or write_span(), unchanged ones keep the previous result
+    // in temporal mode
+    while(x0 < width) {
+      size_t x1 = x0;
+      size_t p_start, p_end;
+      
+      while(x1 < width && flat_ptr[x1 / TILE_SIZE])
+	x1 = FFMIN(x1 + TILE_SIZE, width);
+      
+      if(x1 == x0) {
+	x1 = FFMIN(x0 + TILE_SIZE, width);
+	
+	// textured tiles carry no correction into the upsampling
+	if(frame_info->scale > 1 && !tile_flat_ptr[x0 / TILE_SIZE])
+	  memset(td->interp_out_ptr + 3*(y*width + x0),0,3*(x1-x0)*sizeof(p_float));
+	
+	if(td->fixed)
+	  write_span(frame_info,td->layout,y,x0,x1,NULL);
+	
+	x0 = x1;
+	continue;
+      }
+      
+      p_start = y*width + x0;
+      p_end = y*width + x1;
+      
+      exp_a_ptr = td->exponent_a_ptr + p_start;
+      exp_b_ptr = td->exponent_b_ptr + p_start;
+      near_ptr = td->distance_ptr + p_start;
+      lbl_ptr = td->label_ptr + p_start;
+      
+      for(size_t p = p_start; p < p_end; p++) {
+	lbl = *lbl_ptr;
+	lbl_a = near_ptr->label_a;
+	lbl_b = near_ptr->label_b;
+	p_float wght_alpha = 0.0f;
     
-    p_float diff_a = colour_distance + 1.0f;
-    p_float diff = 0.0f;
+	colour_ptr = &block_colour[lbl-1];
+	// no foreign region within the distance cap
+	colour_a_ptr = lbl_a ? &block_colour[lbl_a-1] : colour_ptr;
+	colour_b_ptr = NULL;
     
-    if(*ma_ptr <= (blabel)spatial_distance) {
-      p_float diff = (p_float)colour_ptr->r - (p_float)colour_a_ptr->r;
-      diff *= diff;
-      diff_a = diff;
-      diff = (p_float)colour_ptr->g - (p_float)colour_a_ptr->g;
-      diff *= diff;
-      diff_a += diff;
-      diff = (p_float)colour_ptr->b - (p_float)colour_a_ptr->b;
-      diff *= diff;
-      diff_a += diff;
-    }
+	p_float diff_a = colour_distance + 1.0f;
+	p_float diff = 0.0f;
     
-    int colour_amp = colour_ptr->r * colour_ptr->r + colour_ptr->g * colour_ptr->g + colour_ptr->b * colour_ptr->b;
-    int colour_amp_a = colour_a_ptr->r * colour_a_ptr->r + colour_a_ptr->g * colour_a_ptr->g + colour_a_ptr->b * colour_a_ptr->b;
+	if(near_ptr->dist_a <= spatial_distance) {
+	  p_float diff = (p_float)colour_ptr->r - (p_float)colour_a_ptr->r;
+	  diff *= diff;
+	  diff_a = diff;
+	  diff = (p_float)colour_ptr->g - (p_float)colour_a_ptr->g;
+	  diff *= diff;
+	  diff_a += diff;
+	  diff = (p_float)colour_ptr->b - (p_float)colour_a_ptr->b;
+	  diff *= diff;
+	  diff_a += diff;
+	}
     
-    bool low_amp = false;
+	int64_t colour_amp = colour_amplitude(colour_ptr,td->layout);
+	int64_t colour_amp_a = colour_amplitude(colour_a_ptr,td->layout);
     
+	bool low_amp = false;
     
-    if(colour_amp < 1 || colour_amp_a < 1) {
-      low_amp = true;
-    }
     
-    if(diff_a < (p_float)colour_distance && !low_amp) {
-      dist_a = (p_float)*ma_ptr / spatial_dist_scale;      
-      *exp_a_ptr = 0.5f / pow(dist_a,*exp_a_ptr);
+	if(colour_amp < amplitude_unit || colour_amp_a < amplitude_unit) {
+	  low_amp = true;
+	}
+    
+	if(diff_a < (p_float)colour_distance && !low_amp) {
+	  wght_alpha = table_weight(weight_table,near_ptr->dist_a,*exp_a_ptr);
+      
+	  wght_alpha += dither_strength*(rand_float(&rng) - 0.5f);
       
-      *exp_a_ptr += dither_strength*(rand_float() - 0.5f);
+	  if(wght_alpha < 0.0f)
+	    wght_alpha = 0.0f;
       
-      if(*exp_a_ptr < 0.0f)
-	*exp_a_ptr = 0.0f;
+	  if(wght_alpha > 1.0f)
+	    wght_alpha = 1.0f;
+	}
+    
+	*exp_a_ptr = wght_alpha;
+	wght_alpha = 0.0f;
+    
+	if(lbl_b > 0  && !low_amp) {
+	  p_float diff_b = colour_distance + 1.0f;
+	  colour_b_ptr = &block_colour[lbl_b-1];	
       
-      if(*exp_a_ptr > 1.0f)
-	*exp_a_ptr = 1.0f;
+	  int64_t colour_amp_b = colour_amplitude(colour_b_ptr,td->layout);
       
-      wght_alpha = *exp_a_ptr;
-      wght_beta = 1.0 - wght_alpha;
-    }
+	  if(near_ptr->dist_b <= spatial_distance && colour_amp_b > amplitude_unit) {				
+	    diff = (p_float)colour_ptr->r - (p_float)colour_b_ptr->r;
+	    diff *= diff;
+	    diff_b = diff;
+	    diff = (p_float)colour_ptr->g - (p_float)colour_b_ptr->g;
+	    diff *= diff;
+	    diff_b += diff;
+	    diff = (p_float)colour_ptr->b - (p_float)colour_b_ptr->b;
+	    diff *= diff;
+	    diff_b += diff;
+	  }
+      
+	  if(diff_b < colour_distance) {
+	    wght_alpha = table_weight(weight_table,near_ptr->dist_b,*exp_b_ptr);
+	
+	    wght_alpha += 0.1f*dither_strength*(rand_float(&rng) - 0.5f);
+	
+	    if(wght_alpha < 0.0f)
+	      wght_alpha = 0.0f;
+	
+	    if(wght_alpha > 1.0f)
+	      wght_alpha = 1.0f;
+	  }
+	}
     
-    out_colour.r = wght_beta * (p_float)colour_ptr->r + wght_alpha * (p_float)colour_a_ptr->r;
-    out_colour.g = wght_beta * (p_float)colour_ptr->g + wght_alpha * (p_float)colour_a_ptr->g;
-    out_colour.b = wght_beta * (p_float)colour_ptr->b + wght_alpha * (p_float)colour_a_ptr->b;
+	*exp_b_ptr = wght_alpha;
+	
+	if(counted && (*exp_a_ptr > 0.0f || wght_alpha > 0.0f))
+	  blend_correction(stat,colour_ptr,colour_a_ptr,colour_b_ptr,*exp_a_ptr,wght_alpha,step);
     
-    if(lbl_b > 0  && !low_amp) {
-      p_float diff_b = colour_distance + 1.0f;
-      colour_b_ptr = &block_colour[lbl_b-1];	
+	exp_a_ptr++;
+	exp_b_ptr++;
+	near_ptr++;
+	lbl_ptr++;
+      }
+      
+      if(td->fixed) {
+	pixel* row_ptr = td->row_buffer + jobnr*width*3;
+	
+	td->dsp->blend_line_fixed(row_ptr,(const uint16_t*)block_colour,
+				  td->label_ptr + p_start,td->distance_ptr + p_start,
+				  td->exponent_a_ptr + p_start,td->exponent_b_ptr + p_start,p_end - p_start);
+	write_span(frame_info,td->layout,y,x0,x1,row_ptr);
+	x0 = x1;
+	continue;
+      }
       
-      int colour_amp_b = colour_b_ptr->r * colour_b_ptr->r + colour_b_ptr->g * colour_b_ptr->g + colour_b_ptr->b * colour_b_ptr->b;
+      td->dsp->blend_line(td->interp_out_ptr + 3*p_start,(const uint16_t*)block_colour,
+			  td->label_ptr + p_start,td->distance_ptr + p_start,
+			  td->exponent_a_ptr + p_start,td->exponent_b_ptr + p_start,p_end - p_start);
       
-      if(*mb_ptr <= spatial_distance && colour_amp_b > 1) {				
-	diff = (p_float)colour_ptr->r - (p_float)colour_b_ptr->r;
-	diff *= diff;
-	diff_b = diff;
-	diff = (p_float)colour_ptr->g - (p_float)colour_b_ptr->g;
-	diff *= diff;
-	diff_b += diff;
-	diff = (p_float)colour_ptr->b - (p_float)colour_b_ptr->b;
-	diff *= diff;
-	diff_b += diff;
+      // the frame is rebuilt from its own samples plus the correction
+      if(frame_info->scale > 1) {
+	p_float* io_ptr = td->interp_out_ptr + 3*p_start;
+	
+	for(size_t p = p_start; p < p_end; p++) {
+	  const RGB_colour* colour = &block_colour[td->label_ptr[p]-1];
+	  
+	  io_ptr[0] -= colour->r;
+	  io_ptr[1] -= colour->g;
+	  io_ptr[2] -= colour->b;
+	  io_ptr += 3;
+	}
       }
       
+      x0 = x1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Write the interpolated image to the output planes. Subsampled chroma is
+ * the mean of the luma resolution samples it covers; slices are split on
+ * rows of each plane so no two jobs write the same chroma row. Textured
+ * tiles keep the input samples.
+ */
+static int store_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+  ThreadData *td = arg;
+  FrameInfo *frame_info = td->frame_info;
+  const PixelLayout *layout = td->layout;
+  const size_t height = frame_info->height;
+  const size_t width = frame_info->width;
+  const p_float max_value = layout->max_value;
+  
+  for (int c = 0; c < 3; c++) {
+    const int step = layout->step[c];
+    const int hsub = layout->hsub[c];
+    const int vsub = layout->vsub[c];
+    const size_t plane_width = FF_CEIL_RSHIFT((int)width, hsub);
+    const size_t plane_start = frame_info->store_start >> vsub;
+    const size_t plane_rows = FF_CEIL_RSHIFT((int)frame_info->store_end, vsub) - plane_start;
+    const size_t slice_start = plane_start + (plane_rows *  jobnr   ) / nb_jobs;
+    const size_t slice_end   = plane_start + (plane_rows * (jobnr+1)) / nb_jobs;
+    const int stride = frame_info->dst_stride[layout->plane[c]];
+    const int src_stride = frame_info->src_stride[layout->plane[c]];
+    const uint8_t* srcrow = frame_info->src_data[layout->plane[c]] + layout->offset[c] + slice_start*src_stride;
+    uint8_t* dstrow = frame_info->dst_data[layout->plane[c]] + layout->offset[c] + slice_start*stride;
+    const int copy = srcrow != dstrow;
     
+    for (size_t i = slice_start; i < slice_end; i++) {
+      const size_t y0 = i << vsub;
+      const size_t y1 = FFMIN((i+1) << vsub, height);
+      const uint8_t* flat_ptr = td->tile_flat + y0 / TILE_SIZE * td->tile_cols;
+      const uint8_t *src = srcrow;
+      uint8_t *dst = dstrow;
       
-      if(diff_b < colour_distance) {
-	dist_b = (p_float)*mb_ptr / spatial_dist_scale;
-	*exp_b_ptr = 0.5f / pow(dist_b,*exp_b_ptr);
+      for (size_t j = 0; j < plane_width; j++, src += step, dst += step) {
+	const size_t x0 = j << hsub;
+	const size_t x1 = FFMIN((j+1) << hsub, width);
+	const p_float* io_ptr;
+	p_float value = 0.0f;
 	
-	*exp_b_ptr += 0.1f*dither_strength*(rand_float() - 0.5f);
+	// the fixed point path comes here without flat tiles or a float image
+	if(!flat_ptr[x0 / TILE_SIZE]) {
+	  if(copy) {
+	    dst[0] = src[0];
+	    if(layout->depth > 8)
+	      dst[1] = src[1];
+	  }
+	  continue;
+	}
 	
-	if(*exp_b_ptr < 0.0f)
-	  *exp_b_ptr = 0.0f;
+	io_ptr = td->interp_out_ptr + 3*(y0*width + x0) + c;
 	
-	if(*exp_b_ptr > 1.0f)
-	  *exp_b_ptr = 1.0f;
-      
-	wght_alpha = *exp_b_ptr;
-	wght_beta = 1.0 - wght_alpha;
+	if(x1 - x0 == 1 && y1 - y0 == 1) {
+	  value = *io_ptr;
+	}
+	else {
+	  for (size_t y = y0; y < y1; y++) {
+	    for (size_t x = x0; x < x1; x++)
+	      value += io_ptr[3*((y-y0)*width + (x-x0))];
+	  }
+	  
+	  value /= (p_float)((y1-y0)*(x1-x0));
+	}
+	
+	value = av_clipf(value + 0.5f, 0.0f, max_value);
+	
+	if(layout->depth > 8)
+	  AV_WN16(dst, (uint16_t)value);
+	else
+	  *dst = (uint8_t)value;
       }
-      else {
-	wght_alpha = 0.0f;
-	wght_beta = 1.0f;
-      }			
       
-      out_colour.r = wght_beta * out_colour.r + wght_alpha * (p_float)colour_b_ptr->r;
-      out_colour.g = wght_beta * out_colour.g + wght_alpha * (p_float)colour_b_ptr->g;
-      out_colour.b = wght_beta * out_colour.b + wght_alpha * (p_float)colour_b_ptr->b;
+      srcrow += src_stride;
+      dstrow += stride;
     }
-    else
-      *exp_b_ptr = 0.0f;
-    
-    *(io_ptr) = out_colour.r;
-    *(io_ptr+1) = out_colour.g;
-    *(io_ptr+2) = out_colour.b;
-        
-    io_ptr += 3;
-    exp_a_ptr++;
-    exp_b_ptr++;
-    ma_ptr++;
-    mb_ptr++;
-    lbl_a_ptr++;
-    lbl_b_ptr++;
-    lbl_ptr++;
   }
+  return 0;
+}
+
+/**
+ * store_slice() for analysis_scale > 1: every output sample is its input
+ * sample plus the bilinearly upsampled correction of the analysis image.
+ */
+static int store_upsampled_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+  ThreadData *td = arg;
+  FrameInfo *frame_info = td->frame_info;
+  const PixelLayout *layout = td->layout;
+  const size_t height = frame_info->full_height;
+  const size_t width = frame_info->full_width;
+  const size_t analysis_width = frame_info->width;
+  const size_t analysis_height = frame_info->height;
+  const p_float inv_scale = 1.0f / frame_info->scale;
+  const p_float max_value = layout->max_value;
   
-  // copy output
-  dstrow = output_ptr;
-  io_ptr = interp_out_ptr;
-  p_float src[3];
-  
-  for (i = 0; i < frame_info->height; i++) {        
-    uint8_t *dst = dstrow;
-        
-    for (j = 0; j < frame_info->width; j++) {
-      offset = 3*j;
-      src[0] = io_ptr[offset + 0] + 0.5f;
-      src[1] = io_ptr[offset + 1] + 0.5f;
-      src[2] = io_ptr[offset + 2] + 0.5f;
-      
-      if(src[0] > 255.0f) 
-	src[0] = 255.0f;
-      
-      if(src[1] > 255.0f) 
-	src[1] = 255.0f;
+  for (int c = 0; c < 3; c++) {
+    const int step = layout->step[c];
+    const int hsub = layout->hsub[c];
+    const int vsub = layout->vsub[c];
+    const size_t plane_width = FF_CEIL_RSHIFT((int)width, hsub);
+    const size_t plane_start = frame_info->store_start >> vsub;
+    const size_t plane_rows = FF_CEIL_RSHIFT((int)frame_info->store_end, vsub) - plane_start;
+    const size_t slice_start = plane_start + (plane_rows *  jobnr   ) / nb_jobs;
+    const size_t slice_end   = plane_start + (plane_rows * (jobnr+1)) / nb_jobs;
+    const int stride = frame_info->dst_stride[layout->plane[c]];
+    const int src_stride = frame_info->src_stride[layout->plane[c]];
+    const uint8_t* srcrow = frame_info->src_data[layout->plane[c]] + layout->offset[c] + slice_start*src_stride;
+    uint8_t* dstrow = frame_info->dst_data[layout->plane[c]] + layout->offset[c] + slice_start*stride;
+    const int copy = srcrow != dstrow;
+    
+    for (size_t i = slice_start; i < slice_end; i++) {
+      const size_t y0 = i << vsub;
+      const size_t y1 = FFMIN((i+1) << vsub, height);
+      const p_float fy = (y0 + y1 - 1) * 0.5f * inv_scale;
+      const size_t ay0 = FFMIN((size_t)fy, analysis_height-1);
+      const size_t ay1 = FFMIN(ay0 + 1, analysis_height-1);
+      const p_float wy = fy - ay0;
+      const p_float* row0 = td->interp_out_ptr + 3*ay0*analysis_width + c;
+      const p_float* row1 = td->interp_out_ptr + 3*ay1*analysis_width + c;
+      const uint8_t* flat_ptr = td->tile_flat + ay0 / TILE_SIZE * td->tile_cols;
+      const uint8_t *src = srcrow;
+      uint8_t *dst = dstrow;
       
-      if(src[2] > 255.0f) 
-	src[2] = 255.0f;
+      for (size_t j = 0; j < plane_width; j++, src += step, dst += step) {
+	const size_t x0 = j << hsub;
+	const size_t x1 = FFMIN((j+1) << hsub, width);
+	const p_float fx = (x0 + x1 - 1) * 0.5f * inv_scale;
+	const size_t ax0 = FFMIN((size_t)fx, analysis_width-1);
+	const size_t ax1 = FFMIN(ax0 + 1, analysis_width-1);
+	const p_float wx = fx - ax0;
+	p_float value;
+	
+	if(!flat_ptr[ax0 / TILE_SIZE]) {
+	  if(copy) {
+	    dst[0] = src[0];
+	    if(layout->depth > 8)
+	      dst[1] = src[1];
+	  }
+	  continue;
+	}
+	
+	value = (1.0f - wy) * ((1.0f - wx) * row0[3*ax0] + wx * row0[3*ax1]) +
+	  wy * ((1.0f - wx) * row1[3*ax0] + wx * row1[3*ax1]);
+	
+	if(layout->depth > 8)
+	  value += AV_RN16(src);
+	else
+	  value += *src;
+	
+	value = av_clipf(value + 0.5f, 0.0f, max_value);
+	
+	if(layout->depth > 8)
+	  AV_WN16(dst, (uint16_t)value);
+	else
+	  *dst = (uint8_t)value;
+      }
       
-      dst[offset + 0] = (pixel)src[0];
-      dst[offset + 1] = (pixel)src[1];
-      dst[offset + 2] = (pixel)src[2];      
+      srcrow += src_stride;
+      dstrow += stride;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Charge the time since *start to a stage and restart the clock.
+ */
+static inline void stage_done(DebandLane *lane, enum DebandStage stage, int64_t *start) {
+  const int64_t now = av_gettime();
+  
+  lane->stage_time[stage] += now - *start;
+  *start = now;
+}
+
+/**
+ * Run func over nb_jobs slices. The graph's slice threads serve one
+ * caller at a time, so pipeline lanes run their slices themselves.
+ */
+static void run_slices(AVFilterContext *ctx, avfilter_action_func *func, ThreadData *td, int nb_jobs) {
+  FlipContext *context = ctx->priv;
+  int i;
+  
+  if(context->nb_lanes > 1) {
+    for(i = 0; i < nb_jobs; i++)
+      func(ctx, td, i, nb_jobs);
+  }
+  else
+    ctx->internal->execute(ctx, func, td, NULL, nb_jobs);
+}
+
+/**
+ * Deband one frame, or one stripe of it, into frame_info->dst_data with
+ * the buffers of lane. Returns the number of tiles processed.
+ */
+static size_t deband_frame(AVFilterContext *ctx, DebandLane *lane, FrameInfo* frame_info) {
+  FlipContext *context = ctx->priv;
+  deband_arena *arena = &lane->arena;
+  ThreadData td;
+  const int nb_jobs = FFMIN(frame_info->height, arena->table.slice_label.size);
+  
+  symbol_list *ingest;
+  size_t _max_label = 0;
+  size_t flat_tiles;
+  const size_t tile_count = arena->tile_flat.size;
+  int64_t clock = av_gettime();
+  
+  arena->table.slice_count = nb_jobs;
+  
+  // the input is packed straight into the symbol plane, or next to it
+  // when the tolerance still has to be applied
+  ingest = context->colour_tol ? &arena->raw_symbol : &arena->table.symbol;
+  
+  // the older buffer takes the new input
+  if(context->temporal)
+    FFSWAP(symbol_list,*ingest,arena->prev_symbol);
+  
+  td.frame_info = frame_info;
+  td.layout = &context->layout;
+  td.symbol_ptr = ingest->data_ptr;
+  td.prev_symbol_ptr = context->temporal ? arena->prev_symbol.data_ptr : NULL;
+  td.table = &arena->table;
+  td.label_ptr = arena->block_label.data_ptr;
+  td.dsp = &context->dsp;
+  td.run_count = arena->run_count.data_ptr;
+  td.row_diff = arena->row_diff.data_ptr;
+  td.tile_flat = arena->tile_flat.data_ptr;
+  td.tile_todo = arena->tile_flat.data_ptr;
+  td.tile_cols = arena->tile_cols;
+  td.interp_out_ptr = arena->dst_list.data_ptr;
+  td.store = frame_info->scale > 1 ? store_upsampled_slice : store_slice;
+  td.row_buffer = arena->row_buffer.data_ptr;
+  td.slice_stat = arena->slice_stat.data_ptr;
+  td.fixed = context->fixed;
+  td.seed = context->seed;
+  td.frame_number = lane->frame_number++;
+  td.colour_tolerance = context->colour_tol << (context->layout.depth - 8);
+  
+  run_slices(ctx, ingest_slice, &td, nb_jobs);
+  
+  // nothing that could be banded, skip the whole pipeline
+  flat_tiles = tile_classify(arena->run_count.data_ptr,frame_info->height,frame_info->width,arena->tile_flat.data_ptr);
+  if(!flat_tiles) {
+    arena->history = 0;
+    
+    // without flat tiles the store copies everything through
+    if(frame_info->src_data[0] != frame_info->dst_data[0])
+      run_slices(ctx, td.store, &td, nb_jobs);
+    stage_done(lane,STAGE_INGEST,&clock);
+    return 0;
+  }
+  
+  // only tiles within reach of a change are blended again, the rest keep
+  // the previous result and its dither
+  if(context->temporal && arena->history) {
+    const int reach = context->spatial_distance / spatial_dist_scale + context->exponent_kernel.size / 2;
+    
+    if(!tile_changes(arena->row_diff.data_ptr,frame_info->height,frame_info->width,(reach + TILE_SIZE-1) / TILE_SIZE,arena->tile_changed.data_ptr)) {
+      run_slices(ctx, td.store, &td, nb_jobs);
+      stage_done(lane,STAGE_INGEST,&clock);
+      return flat_tiles;
     }
     
-    dstrow += frame_info->dst_stride; 
-    io_ptr += src_stride;
+    for(size_t t = 0; t < tile_count; t++)
+      arena->tile_todo.data_ptr[t] = arena->tile_flat.data_ptr[t] & arena->tile_changed.data_ptr[t];
+    td.tile_todo = arena->tile_todo.data_ptr;
   }
+  stage_done(lane,STAGE_INGEST,&clock);
+  
+  run_slices(ctx, label_frame_slice, &td, nb_jobs);
+  label_merge(frame_info->height,frame_info->width,&arena->table,&arena->block_label,&_max_label);
+  run_slices(ctx, resolve_slice, &td, nb_jobs);
+  lane->frame_labels += _max_label;
+  stage_done(lane,STAGE_LABEL,&clock);
+  
+  label_distance(frame_info->height,frame_info->width,&arena->block_label,_max_label,context->spatial_distance,DISTANCE_PASSES,&arena->distance_field,&arena->label_change);
+  stage_done(lane,STAGE_DISTANCE,&clock);
+  
+  // the input before the colour tolerance gives the true region means;
+  // without it every region has a single colour
+  region_stats(td.symbol_ptr,frame_info->height,frame_info->width,&arena->block_label,&arena->distance_field,_max_label,context->colour_tol != 0,&arena->region,&arena->block_colour_list);
+  stage_done(lane,STAGE_STAT,&clock);
+  
   // interpolation
+  td.distance_ptr = arena->distance_field.data_ptr;
+  td.block_colour = arena->block_colour_list.data_ptr;
+  td.region = &arena->region;
+  td.exponent_a_ptr = arena->exponent_a.data_ptr;
+  td.exponent_b_ptr = arena->exponent_b.data_ptr;
+  td.filtered_a_ptr = arena->filtered_a.data_ptr;
+  td.filtered_b_ptr = arena->filtered_b.data_ptr;
+  td.exponent_kernel = &context->exponent_kernel;
+  td.weight_table = context->weight_table.data_ptr;
+  // distances and amplitudes are given for 8-bit samples
+  td.colour_distance = context->colour_dist * (1 << (context->layout.depth - 8));
+  td.colour_distance *= td.colour_distance;
+  td.amplitude_unit = 1LL << 2*(context->layout.depth - 8);
+  td.dither_strength = context->dither_strength;
+  td.spatial_distance = context->spatial_distance;
   
-  // free allocations
-  free_label(&block_label);
-  free_pixel(&src_image);
-  free_collection(&min_field);
-  free_colour(&block_colour_list);
-  free_label(&hist_label_a);
-  free_label(&hist_label_b);
-  free_label(&hist_label);
-  free_float(&dst_list);
-  free_float(&exponent_a);
-  free_float(&exponent_b);
-  free_kernel(&exponent_kernel_2d);  
+  run_slices(ctx, exponent_slice, &td, nb_jobs);
+  run_slices(ctx, filter_rows_slice, &td, nb_jobs);
+  run_slices(ctx, filter_columns_slice, &td, nb_jobs);
+  stage_done(lane,STAGE_EXPONENT,&clock);
+  
+  run_slices(ctx, interpolate_slice, &td, nb_jobs);
+  if(!td.fixed)
+    run_slices(ctx, td.store, &td, nb_jobs);
+  stage_done(lane,STAGE_BLEND,&clock);
+  
+  arena->history = context->temporal;
+  return flat_tiles;
+}
+
+/**
+ * Cut the analysis rows [start, end) plus overlap rows of context on
+ * either side out of frame; only the frame rows of [start, end) are
+ * written.
+ */
+static void set_stripe(FrameInfo *stripe, const FrameInfo *frame, const PixelLayout *layout,
+                       size_t start, size_t end, size_t overlap)
+{
+    const size_t first = start > overlap ? start - overlap : 0;
+    const size_t last = FFMIN(end + overlap, frame->height);
+    const size_t full_first = first * frame->scale;
+    int c;
+
+    *stripe = *frame;
+    stripe->height = last - first;
+    stripe->full_height = FFMIN(last * frame->scale, frame->full_height) - full_first;
+    stripe->row_offset = first;
+    stripe->store_start = start * frame->scale - full_first;
+    stripe->store_end = FFMIN(end * frame->scale, frame->full_height) - full_first;
+
+    // planes shared by several components move once
+    for (c = 0; c < 3; c++) {
+        const int p = layout->plane[c];
+        const size_t rows = full_first >> layout->vsub[c];
+
+        stripe->src_data[p] = frame->src_data[p] + rows * frame->src_stride[p];
+        stripe->dst_data[p] = frame->dst_data[p] + rows * frame->dst_stride[p];
+    }
+}
+
+/**
+ * Banding score in [0,1] of a frame from every DETECT_STEP-th luma sample
+ * of every DETECT_STEP-th row: the larger of the fraction of samples equal
+ * to the next one, as they are across the wide flat runs of bands, and the
+ * fraction of unused codes within the luma range, as left by content
+ * quantised to fewer bits. Texture and noise score near zero on both.
+ */
+#define DETECT_STEP 4
+
+static float banding_score(FlipContext *s, const AVFrame *in)
+{
+    const PixelLayout *layout = &s->layout;
+    blabel *hist = s->detect_hist.data_ptr;
+    const int w = in->width / DETECT_STEP;
+    int64_t samples = 0, flat = 0;
+    int lo = layout->max_value, hi = 0, used = 0;
+    float gaps = 0.0f;
+    int c, x, y, v;
+
+    memset(hist, 0, s->detect_hist.size * sizeof(*hist));
+
+    for (y = 0; y < in->height; y += DETECT_STEP) {
+        const uint8_t *row[3];
+        int prev = -1;
+
+        for (c = 0; c < 3; c++)
+            row[c] = in->data[layout->plane[c]] + layout->offset[c] +
+                     (y >> layout->vsub[c]) * in->linesize[layout->plane[c]];
+
+        for (x = 0; x < w; x++) {
+            int sample[3];
+
+            for (c = 0; c < 3; c++) {
+                const uint8_t *p = row[c] + ((x * DETECT_STEP) >> layout->hsub[c]) * layout->step[c];
+                sample[c] = layout->depth > 8 ? AV_RN16(p) : *p;
+            }
+            v = layout->yuv ? sample[0] : (sample[0] + 2 * sample[1] + sample[2]) >> 2;
+
+            flat += v == prev;
+            prev = v;
+            hist[v]++;
+        }
+        samples += w;
+    }
+
+    for (v = 0; v <= layout->max_value; v++) {
+        if (hist[v]) {
+            lo = FFMIN(lo, v);
+            hi = v;
+            used++;
+        }
+    }
+
+    // too few samples leave gaps of their own
+    if (hi > lo && samples >= 8 * (int64_t)(hi - lo + 1))
+        gaps = 1.0f - (float)used / (hi - lo + 1);
+
+    return FFMAX(samples ? (float)flat / samples : 0.0f, gaps);
+}
+
+/**
+ * Banding score of frame n as recorded by pass 1, or -1 when the analysis
+ * file has no record of a frame with this pts.
+ */
+static float analysis_score(AVFilterContext *ctx, int64_t n, int64_t pts)
+{
+    FlipContext *s = ctx->priv;
+    const uint8_t *record = s->analysis + ANALYSIS_HEADER + n * ANALYSIS_RECORD;
+
+    if (n >= s->analysis_frames || (int64_t)AV_RL64(record) != pts) {
+        if (!s->analysis_mismatch)
+            av_log(ctx, AV_LOG_WARNING, "No analysis of frame %"PRId64" in %s, "
+                   "detecting banding again.\n", n, s->analysis_file_str);
+        s->analysis_mismatch = 1;
+        return -1.0f;
+    }
+
+    return av_int2float(AV_RL32(record + 8));
+}
+
+static int write_analysis(AVFilterContext *ctx, int64_t pts, float score)
+{
+    uint8_t record[ANALYSIS_RECORD];
+
+    AV_WL64(record,     pts);
+    AV_WL32(record + 8, av_float2int(score));
+    return analysis_write(ctx, record, sizeof(record));
+}
+
+static void set_meta(AVDictionary **metadata, const char *key, const char *fmt, double d)
+{
+    char value[128];
+    snprintf(value, sizeof(value), fmt, d);
+    av_dict_set(metadata, key, value, 0);
+}
+
+/**
+ * Export the statistics of the current frame: the number of labels, the
+ * fraction of pixels blended, the mean and largest correction of those
+ * pixels in 8-bit steps, and the time per stage. In temporal mode only
+ * the tiles blended again are counted.
+ */
+static void export_stats(FlipContext *s, const DebandLane *lane, AVDictionary **metadata)
+{
+    const blend_stat *stat = lane->arena.slice_stat.data_ptr;
+    int64_t blended = 0, total_time = 0;
+    double correction_sum = 0.0;
+    float correction_max = 0.0f;
+    char key[64];
+    int i;
+
+    for (i = 0; i < lane->arena.slice_stat.size; i++) {
+        blended        += stat[i].blended;
+        correction_sum += stat[i].correction_sum;
+        correction_max  = FFMAX(correction_max, stat[i].correction_max);
+    }
+
+    if (s->bypass > 0.0f) {
+        set_meta(metadata, "lavfi.deband.score", "%0.4f", lane->score);
+        set_meta(metadata, "lavfi.deband.skipped", "%0.0f", lane->nb_skipped);
+    }
+    set_meta(metadata, "lavfi.deband.labels", "%0.0f", lane->frame_labels);
+    set_meta(metadata, "lavfi.deband.blended", "%0.4f",
+             (double)blended / ((int64_t)s->analysis_width * s->analysis_height));
+    set_meta(metadata, "lavfi.deband.correction_avg", "%0.2f",
+             blended ? correction_sum / blended : 0.0);
+    set_meta(metadata, "lavfi.deband.correction_max", "%0.2f", correction_max);
+
+    for (i = 0; i < STAGE_NB; i++) {
+        snprintf(key, sizeof(key), "lavfi.deband.time.%s", stage_name[i]);
+        set_meta(metadata, key, "%0.0f", lane->stage_time[i]);
+        total_time += lane->stage_time[i];
+    }
+    set_meta(metadata, "lavfi.deband.time", "%0.0f", total_time);
+}
+
+/**
+ * Deband lane->in into lane->out, whole or stripe by stripe.
+ */
+static void process_lane(AVFilterContext *ctx, DebandLane *lane)
+{
+    FlipContext *s = ctx->priv;
+    FrameInfo frame_info;
+    int p, y;
+
+    // lane threads stay off the links, the graph may be freeing them
+    frame_info.width = s->analysis_width;
+    frame_info.height = s->analysis_height;
+    frame_info.full_width = lane->in->width;
+    frame_info.full_height = lane->in->height;
+    frame_info.scale = s->analysis_scale;
+    frame_info.row_offset = 0;
+    frame_info.store_start = 0;
+    frame_info.store_end = lane->in->height;
+    
+    for (p = 0; p < 4; p++) {
+        frame_info.src_data[p] = lane->in->data[p];
+        frame_info.dst_data[p] = lane->out->data[p];
+        frame_info.src_stride[p] = lane->in->linesize[p];
+        frame_info.dst_stride[p] = lane->out->linesize[p];
+    }
+
+    if (!s->stripe_height) {
+        deband_frame(ctx, lane, &frame_info);
+    } else {
+        for (y = 0; y < s->analysis_height; y += s->stripe_height) {
+            FrameInfo stripe;
+            set_stripe(&stripe, &frame_info, &s->layout, y,
+                       FFMIN(y + s->stripe_height, s->analysis_height), s->stripe_overlap);
+            deband_frame(ctx, lane, &stripe);
+        }
+    }
+}
+
+/**
+ * Wait for the frame of a lane, pass it on and free the lane.
+ */
+static int output_lane(AVFilterContext *ctx, DebandLane *lane)
+{
+    FlipContext *s = ctx->priv;
+    AVFrame *out = lane->out;
+
+#if HAVE_THREADS
+    if (lane->running) {
+        pthread_mutex_lock(&lane->lock);
+        while (lane->busy)
+            pthread_cond_wait(&lane->cond, &lane->lock);
+        pthread_mutex_unlock(&lane->lock);
+    }
+#endif
+
+    export_stats(s, lane, avpriv_frame_get_metadatap(out));
+
+    if (out != lane->in)
+        av_frame_free(&lane->in);
+    lane->in = lane->out = NULL;
+
+    return ff_filter_frame(ctx->outputs[0], out);
 }
 
 static int filter_frame(AVFilterLink *inlink, AVFrame *in)
 {    
-    FlipContext *s = inlink->dst->priv;
-    
-    AVFilterLink *outlink = inlink->dst->outputs[0];
-    AVFrame *out;
-    int p, direct;
+    AVFilterContext *ctx = inlink->dst;
+    FlipContext *s = ctx->priv;
+    AVFilterLink *outlink = ctx->outputs[0];
+    DebandLane *lane;
+    int ret;
 
-    if (av_frame_is_writable(in)) {
-        direct = 1;
-        out = in;	
-    } else {	
-        direct = 0;
-        out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
-        if (!out) {
+    if (!s->nb_lanes) {
+        av_frame_free(&in);
+        return AVERROR(EINVAL);
+    }
+    lane = &s->lane[s->next_lane];
+
+    // the oldest frame in flight leaves before its lane takes the new one
+    if (lane->in) {
+        ret = output_lane(ctx, lane);
+        if (ret < 0) {
             av_frame_free(&in);
+            return ret;
+        }
+    }
+    s->next_lane = (s->next_lane + 1) % s->nb_lanes;
+
+    memset(lane->stage_time, 0, sizeof(lane->stage_time));
+    memset(lane->arena.slice_stat.data_ptr, 0, lane->arena.slice_stat.size * sizeof(blend_stat));
+    lane->frame_labels = 0;
+    lane->in = in;
+    s->nb_frames++;
+
+    // frames without banding go through untouched, still in order; pass 1
+    // scores every frame for pass 2 to look up
+    if (s->bypass > 0.0f || s->pass == 1) {
+        const int64_t start = av_gettime();
+
+        lane->score = s->analysis ? analysis_score(ctx, s->nb_frames - 1, in->pts) : -1.0f;
+        if (lane->score < 0.0f)
+            lane->score = banding_score(s, in);
+        lane->stage_time[STAGE_DETECT] = av_gettime() - start;
+
+        if (s->analysis_file) {
+            ret = write_analysis(ctx, in->pts, lane->score);
+            if (ret < 0) {
+                av_frame_free(&lane->in);
+                return ret;
+            }
+        }
+
+        if (s->bypass > 0.0f && lane->score < s->bypass) {
+            s->nb_skipped++;
+            lane->nb_skipped = s->nb_skipped;
+            lane->arena.history = 0;
+            lane->out = in;
+            return s->nb_lanes > 1 ? 0 : output_lane(ctx, lane);
+        }
+        lane->nb_skipped = s->nb_skipped;
+    }
+
+    // stripes read rows of context that the stripe above already wrote
+    if (av_frame_is_writable(in) && !s->stripe_height) {
+        lane->out = in;
+    } else {	
+        lane->out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
+        if (!lane->out) {
+            av_frame_free(&lane->in);
             return AVERROR(ENOMEM);
         }
-        av_frame_copy_props(out, in);
+        av_frame_copy_props(lane->out, in);
     }   
-    
-    size_t height = inlink->h;
-    size_t width = inlink->w;
-    
-    uint8_t *dstrow;
-    uint8_t *srcrow;
-    int i, j;
-    int offset;    
-        
-    FrameInfo frame_info;
-    frame_info.width = width;
-    frame_info.height = height;
-    frame_info.src_stride = (int)in->linesize[0];
-    frame_info.dst_stride = (int)out->linesize[0];
-    
-    dstrow = out->data[0];
-    srcrow = in->data[0];
-    deband_frame(dstrow,srcrow, &frame_info,s);
-    
-    if (!direct)
-        av_frame_free(&in);
 
-    return ff_filter_frame(outlink, out);
+    // every stripe takes a dither frame number, as it would in turn
+    lane->frame_number = s->frame_number;
+    s->frame_number += s->stripe_height ?
+        (s->analysis_height + s->stripe_height - 1) / s->stripe_height : 1;
+
+#if HAVE_THREADS
+    if (lane->running) {
+        pthread_mutex_lock(&lane->lock);
+        lane->busy = 1;
+        pthread_cond_signal(&lane->cond);
+        pthread_mutex_unlock(&lane->lock);
+        return 0;
+    }
+#endif
+
+    process_lane(ctx, lane);
+    return output_lane(ctx, lane);
+}
+
+/**
+ * Pass on every frame still in flight, in input order. Returns the number
+ * of frames passed on or a negative error code.
+ */
+static int flush_lanes(AVFilterContext *ctx)
+{
+    FlipContext *s = ctx->priv;
+    int i, ret, nb_flushed = 0;
+
+    if (!s->nb_lanes)
+        return AVERROR(EINVAL);
+
+    for (i = 0; i < s->nb_lanes; i++) {
+        DebandLane *lane = &s->lane[(s->next_lane + i) % s->nb_lanes];
+
+        if (lane->in) {
+            ret = output_lane(ctx, lane);
+            if (ret < 0)
+                return ret;
+            nb_flushed++;
+        }
+    }
+
+    return nb_flushed;
+}
+
+static int request_frame(AVFilterLink *outlink)
+{
+    AVFilterContext *ctx = outlink->src;
+    int ret = ff_request_frame(ctx->inputs[0]);
+
+    if (ret == AVERROR_EOF) {
+        int nb_flushed = flush_lanes(ctx);
+        if (nb_flushed)
+            ret = FFMIN(nb_flushed, 0);
+    }
+
+    return ret;
+}
+
+static int process_command(AVFilterContext *ctx, const char *cmd, const char *args,
+                           char *res, int res_len, int flags)
+{
+    FlipContext *s = ctx->priv;
+    int i, ret;
+
+    if (strcmp(cmd, "colour_dist") && strcmp(cmd, "dither_strength") &&
+        strcmp(cmd, "spatial_dist") && strcmp(cmd, "kernel_size"))
+        return AVERROR(ENOSYS);
+
+    // the header of a pipe cannot follow the change
+    if (s->analysis_header && strcmp(cmd, "colour_dist") && strcmp(cmd, "dither_strength") &&
+        ftell(s->analysis_file) < 0) {
+        av_log(ctx, AV_LOG_ERROR, "Cannot change %s with an unseekable analysis file.\n", cmd);
+        return AVERROR(EINVAL);
+    }
+
+    // frames in flight are finished with the values they started with
+    if (s->nb_lanes) {
+        ret = flush_lanes(ctx);
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = av_opt_set(s, cmd, args, 0);
+    if (ret < 0)
+        return ret;
+
+    // temporal mode blends every tile again with the new values
+    for (i = 0; i < s->nb_lanes; i++)
+        s->lane[i].arena.history = 0;
+
+    // colour_dist and dither_strength are read afresh for every frame
+    if (!s->nb_lanes || (strcmp(cmd, "spatial_dist") && strcmp(cmd, "kernel_size")))
+        return 0;
+
+    ret = config_params(ctx);
+    if (ret < 0)
+        return ret;
+
+    // stripes take as many rows of context as the new values reach
+    return config_lanes(ctx, s->nb_lanes);
 }
 
 #define OFFSET(x) offsetof(FlipContext, x)
@@ -465,9 +1912,19 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
 
 static const AVOption deband_options[] = {
     { "colour_dist", "Defines radius for sphere of colours for interpolation.", OFFSET(colour_dist), AV_OPT_TYPE_FLOAT, { .dbl = 5.0 }, 0.0, 30.0, FLAGS },
+    { "colour_tol", "Tolerance per component for joining isolated pixels to the surrounding region.", OFFSET(colour_tol), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 16, FLAGS },
     { "spatial_dist",   "Radius of local interpolation influence.",                          OFFSET(spatial_dist),   AV_OPT_TYPE_INT,   { .i64 = -1  }, -1,    40, FLAGS },
     { "dither_strength", "Dither strength", OFFSET(dither_strength), AV_OPT_TYPE_FLOAT, { .dbl = 1.0 }, 0.0, 10.0, FLAGS },
+    { "seed", "Dither noise seed.", OFFSET(seed), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, FLAGS },
     { "kernel_size",   "Exponent filter kernel size.",                          OFFSET(kernel_size),   AV_OPT_TYPE_INT,   { .i64 = -1  }, -1,    9, FLAGS },
+    { "analysis_scale", "Analyse every n-th pixel of every n-th row and upsample the correction.", OFFSET(analysis_scale), AV_OPT_TYPE_INT, { .i64 = 1 }, 1, 8, FLAGS },
+    { "stripe_rows", "Process the frame in stripes of this many analysis rows, 0 for whole frames.", OFFSET(stripe_rows), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, FLAGS },
+    { "fixed_point", "Blend in fixed point straight into the output frame.", OFFSET(fixed_point), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, FLAGS },
+    { "temporal", "Only re-blend tiles changed since the previous frame.", OFFSET(temporal), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, FLAGS },
+    { "bypass", "Pass frames with a banding score below this through untouched, 0 to deband every frame.", OFFSET(bypass), AV_OPT_TYPE_FLOAT, { .dbl = 0.0 }, 0.0, 1.0, FLAGS },
+    { "pipeline", "Deband up to this many frames at once, each on a thread of its own, 0 for one at a time.", OFFSET(pipeline), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 16, FLAGS },
+    { "pass", "1 to write banding scores and chosen parameters to analysis_file, 2 to read them back instead of detecting again, 0 for neither.", OFFSET(pass), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 2, FLAGS },
+    { "analysis_file", "Analysis file of the pass option.", OFFSET(analysis_file_str), AV_OPT_TYPE_STRING, { .str = "deband_analysis.bin" }, 0, 0, FLAGS },
     { NULL }
 };
 
@@ -486,8 +1943,9 @@ static const AVFilterPad avfilter_vf_deband_inputs[] = {
 
 static const AVFilterPad avfilter_vf_deband_outputs[] = {
     {
-        .name = "default",
-        .type = AVMEDIA_TYPE_VIDEO,
+        .name          = "default",
+        .type          = AVMEDIA_TYPE_VIDEO,
+        .request_frame = request_frame,
     },
     { NULL }
 };
@@ -498,7 +1956,10 @@ AVFilter ff_vf_deband = {
     .priv_size   = sizeof(FlipContext),
     .priv_class    = &deband_class,
     .init          = init,
+    .uninit        = uninit,
     .query_formats = query_formats,
+    .process_command = process_command,
     .inputs      = avfilter_vf_deband_inputs,
     .outputs     = avfilter_vf_deband_outputs,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
\ No newline at end of file
@@ -22,8 +22,9 @@
 #ifndef VF_DEBAND_H
 #define VF_DEBAND_H
 typedef float p_float; 
-typedef unsigned char pixel; 
+typedef uint16_t pixel; 
 typedef int blabel;
+typedef uint64_t bsymbol;
 typedef short bool;
 
 #define true 1
@@ -82,6 +83,7 @@ enum ReverseNE {
 };
 
 
+// holds Y,U,V in r,g,b for YUV input
 typedef struct {
   pixel r;
   pixel g;
@@ -96,10 +98,18 @@ typedef struct {
 } f_RGB_colour;
 
 typedef struct {
-  size_t width;
+  size_t width;        // analysis resolution
   size_t height;
-  int src_stride;
-  int dst_stride;
+  size_t full_width;   // frame resolution
+  size_t full_height;
+  int scale;           // frame pixels per analysis pixel along each axis
+  size_t row_offset;   // analysis row of the first row within the frame
+  size_t store_start;  // frame rows [store_start, store_end) are written
+  size_t store_end;
+  const uint8_t *src_data[4];
+  uint8_t *dst_data[4];
+  int src_stride[4];
+  int dst_stride[4];
 } FrameInfo;
 
 typedef struct {
@@ -118,23 +128,119 @@ typedef struct {
 }float_list;
 
 typedef struct {
-  blabel* data_ptr0;
-  blabel* data_ptr1;
-  blabel* data_ptr2;
-  blabel* data_ptr3;
+  pixel* data_ptr;
   size_t size;
-}label_list_collection;
+}pixel_list;
 
 typedef struct {
-  pixel* data_ptr;
+  DebandDistance* data_ptr;
   size_t size;
-}pixel_list;
+}distance_list;
+
+typedef struct {
+  uint8_t* data_ptr;
+  size_t size;
+}byte_list;
+
+// blend statistics of one slice, corrections in 8-bit steps
+typedef struct {
+  int64_t blended;         // pixels given a nonzero blend weight
+  double correction_sum;   // of the largest component change per pixel
+  p_float correction_max;
+} blend_stat;
+
+typedef struct {
+  blend_stat* data_ptr;
+  size_t size;
+}stat_list;
+
+typedef struct {
+  bsymbol* data_ptr;
+  size_t size;
+}symbol_list;
+
+// one region of the label plane, valid once the region has an area
+typedef struct {
+  int64_t sum[3];          // component sums of the input samples
+} region_stat;
+
+// per label statistics; the counters are kept apart from the rest as
+// they are scattered to once per pixel, the sums as they are only taken
+// for regions of several colours. Entry 0 of near_a and near_b counts the
+// pixels without a foreign label.
+typedef struct {
+  region_stat* data_ptr;
+  symbol_list first;       // input symbol of the first pixel
+  label_list area;
+  label_list near_a;       // pixels with the region as nearest foreign label
+  label_list near_b;       // pixels with the region as second nearest
+  size_t size;
+}region_list;
+
+// chamfer distances saturate here, far beyond any spatial_dist
+#define DIST_MAX UINT16_MAX
+// forward/backward sweep pairs of label_distance(); with distances capped
+// at spatial_dist natural images settle in 2-3, regions folding back on
+// themselves more often within that radius keep longer distances
+#define DISTANCE_PASSES 4
+
+// tiles of TILE_SIZE^2 pixels are classified before labelling; a tile is
+// debanded once 1/FLAT_TILE_RATIO of its pixels repeat their left neighbour
+#define TILE_SIZE 32
+#define FLAT_TILE_RATIO 4
+// label_slice() labels a row run by run when the row above has at most
+// width/RUN_ROW_DIVISOR runs, pixel by pixel otherwise
+#define RUN_ROW_DIVISOR 16
 
 typedef struct {
-  float_list kernel;
-  label_list x_rel;
-  label_list y_rel;
+  symbol_list symbol;      // packed colour of each pixel
+  label_list parent;       // union-find table of provisional labels
+  label_list slice_label;  // next unused provisional label of each slice
+  label_list run;          // run starts and labels of two rows per slice
+  size_t run_stride;       // run entries of one slice
+  size_t slice_count;
+} label_table;
+
+typedef struct {
+  symbol_list raw_symbol;  // input symbols before the colour tolerance
+  label_list block_label;
+  label_table table;
+  distance_list distance_field;
+  label_list label_change;
+  rgb_colour_list block_colour_list;
+  region_list region;
+  float_list exponent_a;
+  float_list exponent_b;
+  float_list filtered_a;
+  float_list filtered_b;
+  float_list dst_list;
+  pixel_list row_buffer;   // fixed point path: one output row per slice
+  stat_list slice_stat;    // blend statistics per slice
+  byte_list run_count;     // repeated pixels per row and tile column
+  byte_list tile_flat;     // tiles that may contain banding
+  symbol_list prev_symbol; // temporal mode: input symbols of the previous frame
+  byte_list row_diff;      // rows of each tile column changed since prev_symbol
+  byte_list tile_changed;
+  byte_list tile_todo;     // flat tiles to blend this frame
+  int history;             // dst_list holds the result for prev_symbol
+  size_t tile_cols;
+  size_t width;
+  size_t height;
+  size_t pixel_count;
+} deband_arena;
+
+// chamfer units per pixel of the 5-7 distance transform
+static const float spatial_dist_scale = 5.0f;
+
+#define MAX_BOX_SIZE 16
+
+// exponent steps over [0,0.5] per distance in the blend weight table
+#define WEIGHT_TABLE_STEPS 256
+
+typedef struct {
+  float_list kernel;  // normalised 1-D triangular taps
   size_t size;
+  size_t box_size;    // the kernel is two convolved boxes of this width
 } filter_kernel;
 
 
@@ -142,50 +248,51 @@ typedef struct {
 static void allocate_colour(rgb_colour_list* ptr, size_t size) {
   ptr->size = size;
   
-  ptr->data_ptr = (RGB_colour*)av_malloc(size*sizeof(RGB_colour));
-  memset((void*)ptr->data_ptr,0,size*sizeof(RGB_colour));
-}
-
-static void allocate_collection(label_list_collection *ptr, size_t size) {
-  ptr->size = size;
-  
-  ptr->data_ptr0 = (blabel*)av_malloc(size*sizeof(blabel));
-  memset((void*)ptr->data_ptr0,0,size*sizeof(blabel));
-  
-  ptr->data_ptr1 = (blabel*)av_malloc(size*sizeof(blabel));
-  memset((void*)ptr->data_ptr1,0,size*sizeof(blabel));
-  
-  ptr->data_ptr2 = (blabel*)av_malloc(size*sizeof(blabel));
-  memset((void*)ptr->data_ptr2,0,size*sizeof(blabel));
-  
-  ptr->data_ptr3 = (blabel*)av_malloc(size*sizeof(blabel));
-  memset((void*)ptr->data_ptr3,0,size*sizeof(blabel));
+  ptr->data_ptr = (RGB_colour*)av_mallocz(size*sizeof(RGB_colour));
 }
 
 static void allocate_label(label_list* ptr, size_t size) {
-  ptr->data_ptr = (blabel*)av_malloc(size*sizeof(blabel));
-  memset((void*)ptr->data_ptr,0,size*sizeof(blabel));
+  ptr->data_ptr = (blabel*)av_mallocz(size*sizeof(blabel));
   ptr->size = size;
 }
 
 static void allocate_float(float_list* ptr, size_t size) {
-  ptr->data_ptr = (p_float*)av_malloc(size*sizeof(p_float));
-  memset((void*)ptr->data_ptr,0,size*sizeof(p_float));
+  ptr->data_ptr = (p_float*)av_mallocz(size*sizeof(p_float));
   ptr->size = size;
 }
 
 static void allocate_pixel(pixel_list* ptr, size_t size) {
-  ptr->data_ptr = (pixel*)av_malloc(size*sizeof(pixel));
-  memset((void*)ptr->data_ptr,0,size*sizeof(pixel));
+  ptr->data_ptr = (pixel*)av_mallocz(size*sizeof(pixel));
   ptr->size = size;
 }
 
-static void free_collection(label_list_collection *ptr) {
-  av_free(ptr->data_ptr0);
-  av_free(ptr->data_ptr1);
-  av_free(ptr->data_ptr2);
-  av_free(ptr->data_ptr3);
-  ptr->size = 0;
+static void allocate_symbol(symbol_list* ptr, size_t size) {
+  ptr->data_ptr = (bsymbol*)av_mallocz(size*sizeof(bsymbol));
+  ptr->size = size;
+}
+
+static void allocate_distance(distance_list* ptr, size_t size) {
+  ptr->data_ptr = (DebandDistance*)av_mallocz(size*sizeof(DebandDistance));
+  ptr->size = size;
+}
+
+static void allocate_byte(byte_list* ptr, size_t size) {
+  ptr->data_ptr = (uint8_t*)av_mallocz(size);
+  ptr->size = size;
+}
+
+static void allocate_stat(stat_list* ptr, size_t size) {
+  ptr->data_ptr = (blend_stat*)av_mallocz(size*sizeof(blend_stat));
+  ptr->size = size;
+}
+
+static void allocate_region(region_list* ptr, size_t size) {
+  ptr->data_ptr = (region_stat*)av_mallocz(size*sizeof(region_stat));
+  allocate_symbol(&ptr->first,size);
+  allocate_label(&ptr->area,size);
+  allocate_label(&ptr->near_a,size);
+  allocate_label(&ptr->near_b,size);
+  ptr->size = size;
 }
 
 static void free_label(label_list* ptr) {
@@ -198,6 +305,35 @@ static void free_pixel(pixel_list* ptr) {
   ptr->size = 0;
 }
 
+static void free_symbol(symbol_list* ptr) {
+  av_free(ptr->data_ptr);
+  ptr->size = 0;
+}
+
+static void free_distance(distance_list* ptr) {
+  av_free(ptr->data_ptr);
+  ptr->size = 0;
+}
+
+static void free_byte(byte_list* ptr) {
+  av_free(ptr->data_ptr);
+  ptr->size = 0;
+}
+
+static void free_stat(stat_list* ptr) {
+  av_free(ptr->data_ptr);
+  ptr->size = 0;
+}
+
+static void free_region(region_list* ptr) {
+  av_free(ptr->data_ptr);
+  free_symbol(&ptr->first);
+  free_label(&ptr->area);
+  free_label(&ptr->near_a);
+  free_label(&ptr->near_b);
+  ptr->size = 0;
+}
+
 static void free_colour(rgb_colour_list* ptr) {
   av_free(ptr->data_ptr);
   ptr->size = 0;
@@ -208,29 +344,128 @@ static void free_float(float_list* ptr) {
   ptr->size = 0;
 }
 
+static void allocate_label_table(label_table* ptr, size_t width, size_t height, size_t slice_count) {
+  allocate_symbol(&ptr->symbol,width*height);
+  allocate_label(&ptr->parent,width*height+1);
+  allocate_label(&ptr->slice_label,slice_count);
+  allocate_label(&ptr->run,4*(width+1)*slice_count);
+  ptr->run_stride = 4*(width+1);
+  ptr->slice_count = slice_count;
+}
+
+static void free_label_table(label_table* ptr) {
+  free_symbol(&ptr->symbol);
+  free_label(&ptr->parent);
+  free_label(&ptr->slice_label);
+  free_label(&ptr->run);
+  ptr->run_stride = 0;
+  ptr->slice_count = 0;
+}
+
+static void free_arena(deband_arena* ptr) {
+  free_symbol(&ptr->raw_symbol);
+  free_label(&ptr->block_label);
+  free_label_table(&ptr->table);
+  free_distance(&ptr->distance_field);
+  free_label(&ptr->label_change);
+  free_colour(&ptr->block_colour_list);
+  free_region(&ptr->region);
+  free_float(&ptr->exponent_a);
+  free_float(&ptr->exponent_b);
+  free_float(&ptr->filtered_a);
+  free_float(&ptr->filtered_b);
+  free_float(&ptr->dst_list);
+  free_pixel(&ptr->row_buffer);
+  free_stat(&ptr->slice_stat);
+  free_byte(&ptr->run_count);
+  free_byte(&ptr->tile_flat);
+  free_symbol(&ptr->prev_symbol);
+  free_byte(&ptr->row_diff);
+  free_byte(&ptr->tile_changed);
+  free_byte(&ptr->tile_todo);
+  ptr->history = 0;
+  ptr->tile_cols = 0;
+  ptr->width = 0;
+  ptr->height = 0;
+  ptr->pixel_count = 0;
+}
+
+/**
+ * Allocate all per-frame working buffers for width x height frames
+ * processed in at most slice_count slices. Label indexed buffers are sized
+ * for the worst case of one label per pixel; the float output image is left
+ * out for the fixed point path.
+ */
+static int allocate_arena(deband_arena* ptr, size_t width, size_t height, size_t slice_count, int fixed) {
+  const size_t pixel_count = width*height;
+  const size_t tile_cols = (width + TILE_SIZE-1) / TILE_SIZE;
+  
+  allocate_label(&ptr->block_label,pixel_count);
+  allocate_label_table(&ptr->table,width,height,slice_count);
+  allocate_distance(&ptr->distance_field,pixel_count);
+  allocate_label(&ptr->label_change,pixel_count);
+  allocate_colour(&ptr->block_colour_list,pixel_count);
+  allocate_region(&ptr->region,pixel_count+1);
+  allocate_float(&ptr->exponent_a,pixel_count);
+  allocate_float(&ptr->exponent_b,pixel_count);
+  allocate_float(&ptr->filtered_a,pixel_count);
+  allocate_float(&ptr->filtered_b,pixel_count);
+  // the fixed point path blends straight into the output frame
+  if(!fixed)
+    allocate_float(&ptr->dst_list,pixel_count*3);
+  allocate_pixel(&ptr->row_buffer,width*3*slice_count);
+  allocate_stat(&ptr->slice_stat,slice_count);
+  allocate_byte(&ptr->run_count,height*tile_cols);
+  allocate_byte(&ptr->tile_flat,(height + TILE_SIZE-1) / TILE_SIZE * tile_cols);
+  allocate_byte(&ptr->row_diff,height*tile_cols);
+  allocate_byte(&ptr->tile_changed,(height + TILE_SIZE-1) / TILE_SIZE * tile_cols);
+  allocate_byte(&ptr->tile_todo,(height + TILE_SIZE-1) / TILE_SIZE * tile_cols);
+  ptr->tile_cols = tile_cols;
+  ptr->width = width;
+  ptr->height = height;
+  ptr->pixel_count = pixel_count;
+  
+  if(!ptr->block_label.data_ptr ||
+     !ptr->table.symbol.data_ptr || !ptr->table.parent.data_ptr || !ptr->table.slice_label.data_ptr || !ptr->table.run.data_ptr ||
+     !ptr->distance_field.data_ptr || !ptr->label_change.data_ptr ||
+     !ptr->block_colour_list.data_ptr ||
+     !ptr->region.data_ptr || !ptr->region.first.data_ptr || !ptr->region.area.data_ptr || !ptr->region.near_a.data_ptr || !ptr->region.near_b.data_ptr ||
+     !ptr->exponent_a.data_ptr || !ptr->exponent_b.data_ptr ||
+     !ptr->filtered_a.data_ptr || !ptr->filtered_b.data_ptr || (!fixed && !ptr->dst_list.data_ptr) ||
+     !ptr->row_buffer.data_ptr || !ptr->slice_stat.data_ptr || !ptr->run_count.data_ptr || !ptr->tile_flat.data_ptr ||
+     !ptr->row_diff.data_ptr || !ptr->tile_changed.data_ptr || !ptr->tile_todo.data_ptr) {
+    free_arena(ptr);
+    return AVERROR(ENOMEM);
+  }
+  
+  return 0;
+}
+
 static void allocate_kernel(filter_kernel* ptr, size_t size) {
   allocate_float(&ptr->kernel,size);
-  allocate_label(&ptr->x_rel,size);
-  allocate_label(&ptr->y_rel,size);
   ptr->size = size;
 }
 
 static void free_kernel(filter_kernel* ptr) {
   free_float(&ptr->kernel);
-  free_label(&ptr->x_rel);
-  free_label(&ptr->y_rel);
   ptr->size = 0;
 }
 
 
-static void label(pixel* rgb_ptr,const size_t height,const size_t width,label_list *block_label,size_t *_max_label);
-static void label_forward(const label_list *block_init_label, const size_t blocks_per_row,const size_t blocks_per_column,label_list *block_label);
-static void label_backward(const label_list *block_init_label, const size_t blocks_per_row,const size_t blocks_per_column,label_list *block_label);
-static void label_distance(const size_t height,const size_t width,label_list *block_label,size_t max_label,label_list_collection *min_field);
-static void label_stat(pixel*src_ptr,const size_t height,const size_t width,label_list *block_label,size_t _max_label,rgb_colour_list* block_colour_list);
-static void label_histogram(blabel* label_ptr, label_list *hist,size_t pixel_count);
-static void set_kernel_size(size_t kernel_size, filter_kernel* exponent_kernel_2d);
-static void filter_exponent(const size_t height,const size_t width,float_list* exp_list, filter_kernel* exponent_kernel_2d);
+static void tolerant_slice(const bsymbol* in,const size_t height,const size_t width,size_t slice_start,size_t slice_end,int tolerance,bsymbol* out);
+static void label_slice(const size_t width,size_t slice_start,size_t slice_end,size_t slice_index,label_table *table,label_list *block_label,int (*run_length)(const bsymbol*,int));
+static void label_merge(const size_t height,const size_t width,label_table *table,label_list *block_label,size_t *_max_label);
+static void label_resolve(const size_t width,size_t slice_start,size_t slice_end,label_table *table,label_list *block_label);
+static void label_distance(const size_t height,const size_t width,label_list *block_label,size_t max_label,int max_distance,int max_passes,distance_list *distance_field,label_list *label_change);
+static void region_stats(const bsymbol* symbol,const size_t height,const size_t width,const label_list *block_label,const distance_list *distance_field,size_t max_label,int mean,region_list *region,rgb_colour_list *block_colour_list);
+static void tile_runs(const bsymbol* symbol,const size_t width,size_t slice_start,size_t slice_end,int tolerance,uint8_t* run_count,size_t tile_cols);
+static size_t tile_classify(const uint8_t* run_count,const size_t height,const size_t width,uint8_t* tile_flat);
+static void tile_diff(const bsymbol* symbol,const bsymbol* prev,const size_t width,size_t slice_start,size_t slice_end,uint8_t* row_diff,size_t tile_cols);
+static size_t tile_changes(const uint8_t* row_diff,const size_t height,const size_t width,int radius,uint8_t* tile_changed);
+static void set_kernel_size(size_t kernel_size, filter_kernel* exponent_kernel);
+static void filter_exponent_rows(const size_t height,const size_t width,size_t slice_start,size_t slice_end,const p_float* exp_ptr,p_float* out_ptr, filter_kernel* exponent_kernel);
+static void set_weight_table(size_t max_distance, float_list* weight_table);
+static void filter_exponent_columns(const size_t height,const size_t width,size_t slice_start,size_t slice_end,const p_float* in_ptr,p_float* out_ptr, filter_kernel* exponent_kernel);
 #endif
 
 
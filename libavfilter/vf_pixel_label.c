@@ -25,6 +25,7 @@
 #include "avfilter.h"
 #include "internal.h"
 #include "video.h"
+#include "deband.h"
 #include "vf_deband.h"
 #include "limits.h"
 
@@ -43,390 +44,366 @@ static void print_label_field(const size_t height,const size_t width, label_list
   }
 }
 
-static void label(pixel* rgb_ptr,const size_t height,const size_t width,label_list *block_label,size_t *_max_label) {
-  label_list init_label;
-  size_t stride = width*3;
-  allocate_label(&init_label,height*width);
- 
-  label_list _block_label;
-  allocate_label(&_block_label,init_label.size);
-  
-  label_list _block_label_prev;
-  allocate_label(&_block_label_prev,init_label.size);
-  
-  pixel* row_ptr = 0;
+static inline blabel label_find(blabel* parent, blabel lbl) {
+  blabel root = lbl;
   
-  blabel* lbl_ptr = init_label.data_ptr;
-  blabel* row_lbl_ptr = 0;
+  while(parent[root] != root)
+    root = parent[root];
   
-  for(size_t y = 0; y < height; y++) {
-    row_ptr = rgb_ptr + y*stride;
-    row_lbl_ptr = lbl_ptr + y*width;
-    
-    for(size_t x = 0; x < width; x++) {
-      *row_lbl_ptr = *row_ptr + 256*(*(row_ptr+1)) + 65536*(*(row_ptr+2));      
-      row_lbl_ptr++;
-      row_ptr += 3;
-    }    
+  // path compression
+  while(parent[lbl] != root) {
+    blabel next = parent[lbl];
+    parent[lbl] = root;
+    lbl = next;
   }
   
-  size_t block_label_size = _block_label.size;
+  return root;
+}
+
+static inline void label_union(blabel* parent, blabel lbl_a, blabel lbl_b) {
+  lbl_a = label_find(parent,lbl_a);
+  lbl_b = label_find(parent,lbl_b);
   
-  while(1) {
-    
-    label_forward(&init_label,width,height,&_block_label);    
-    label_backward(&init_label,width,height,&_block_label);
-   
-    short different = 0;
-    
-    for(size_t p = 0; p < block_label_size; p++) {
-      if(_block_label_prev.data_ptr[p] != _block_label.data_ptr[p])
-      {
-	different = 1;
-	break;
-      }
-    }
-    
-    if(!different)
-      break;
-    
-    memcpy(_block_label_prev.data_ptr,_block_label.data_ptr,_block_label_prev.size*sizeof(blabel));
-  }
+  // the smallest provisional label is kept as root
+  if(lbl_a < lbl_b)
+    parent[lbl_b] = lbl_a;
+  else if(lbl_b < lbl_a)
+    parent[lbl_a] = lbl_b;
+}
+
+static inline bsymbol pack_symbol(const pixel* pel) {
+  return pel[0] | (bsymbol)pel[1] << 16 | (bsymbol)pel[2] << 32;
+}
+
+static inline int symbol_within(bsymbol a,bsymbol b,int tolerance) {
+  return FFABS((int)(a & 0xffff) - (int)(b & 0xffff)) <= tolerance &&
+         FFABS((int)(a >> 16 & 0xffff) - (int)(b >> 16 & 0xffff)) <= tolerance &&
+         FFABS((int)(a >> 32) - (int)(b >> 32)) <= tolerance;
+}
+
+/**
+ * Symbol of an inner pixel with a colour tolerance. A pixel matching fewer
+ * than two of its eight neighbours takes the colour shared by at least
+ * five of them when it is within tolerance of it, so speckle joins the
+ * surrounding region while the one step edges between bands stay intact.
+ * Merging any neighbours within tolerance would chain across those edges
+ * and swallow the whole gradient.
+ */
+static inline bsymbol tolerant_symbol(const bsymbol* sym_ptr,size_t width,int tolerance) {
+  static const int orthogonal[4] = { 1, 3, 4, 6 };
+  const bsymbol symbol[8] = {
+    sym_ptr[-width-1], sym_ptr[-width], sym_ptr[-width+1], sym_ptr[-1],
+    sym_ptr[1], sym_ptr[width-1], sym_ptr[width], sym_ptr[width+1]
+  };
+  const bsymbol sym = *sym_ptr;
+  int own = 0;
   
-  blabel min_label = INT_MAX;
-  blabel max_label = 0;
+  for(int n = 0; n < 8; n++)
+    own += symbol[n] == sym;
   
-  blabel lbl = 0;
+  if(own >= 2)
+    return sym;
   
-   
-  for(size_t blk = 0; blk < block_label_size; blk++) {
-    lbl = _block_label.data_ptr[blk];
-    
-    if(lbl > max_label)
-      max_label = lbl;
+  for(int i = 0; i < 4; i++) {
+    const int n = orthogonal[i];
+    int count = 0;
     
-    if(lbl < min_label)
-      min_label = lbl;
-  }  
+    for(int m = 0; m < 8; m++)
+      count += symbol[m] == symbol[n];
     
-  size_t label_count = max_label - min_label + 2;
-  
-  label_list label_mapping;
-  allocate_label(&label_mapping,label_count);
-  
-  blabel current_label = 1;
+    if(count >= 5)
+      return symbol_within(sym,symbol[n],tolerance) ? symbol[n] : sym;
+  }
   
-  for(size_t blk = 0; blk < block_label_size; blk++) {
-    lbl = _block_label.data_ptr[blk];
+  return sym;
+}
+
+/**
+ * Apply tolerant_symbol() to rows [slice_start, slice_end) of the input
+ * symbols. This reads the rows next to the slice, so the whole input must
+ * be ready; border pixels are copied unchanged.
+ */
+static void tolerant_slice(const bsymbol* in,const size_t height,const size_t width,size_t slice_start,size_t slice_end,int tolerance,bsymbol* out) {
+  for(size_t y = slice_start; y < slice_end; y++) {
+    const bsymbol* in_ptr = in + y*width;
+    bsymbol* out_ptr = out + y*width;
     
-    if(label_mapping.data_ptr[lbl] == 0) {
-      label_mapping.data_ptr[lbl] = current_label;
-      current_label++;
+    if(y == 0 || y == height-1 || width < 3) {
+      memcpy(out_ptr,in_ptr,width*sizeof(bsymbol));
+      continue;
     }
+    
+    out_ptr[0] = in_ptr[0];
+    for(size_t x = 1; x < width-1; x++)
+      out_ptr[x] = tolerant_symbol(in_ptr + x,width,tolerance);
+    out_ptr[width-1] = in_ptr[width-1];
   }
+}
+
+/**
+ * Label one row pixel by pixel against the row above (decision tree of
+ * Wu et al.). Returns an estimate of the number of runs of the row.
+ */
+static inline size_t label_row_pixels(const size_t width,const bsymbol* symbol,blabel* label_ptr,bool top,blabel* parent_ptr,blabel* next_label) {
+  size_t count = 1;
   
-  for(size_t blk = 0; blk < block_label_size; blk++) {
-    lbl = _block_label.data_ptr[blk];
+  for(size_t x = 0; x < width; x++) {
+    bsymbol sym = *symbol;
+    blabel lbl = 0;
     
-    block_label->data_ptr[blk] = label_mapping.data_ptr[lbl];
+    if(top && *(symbol-width) == sym) {
+      // top; top left and top right are already connected through it
+      lbl = *(label_ptr-width);
+    }
+    else if(top && x < width-1 && *(symbol-width+1) == sym) {
+      // top right
+      lbl = *(label_ptr-width+1);
+      
+      if(x > 0 && *(symbol-width-1) == sym)
+	label_union(parent_ptr,lbl,*(label_ptr-width-1));
+      else if(x > 0 && *(symbol-1) == sym)
+	label_union(parent_ptr,lbl,*(label_ptr-1));
+    }
+    else if(top && x > 0 && *(symbol-width-1) == sym) {
+      // top left
+      lbl = *(label_ptr-width-1);
+    }
+    else if(x > 0 && *(symbol-1) == sym) {
+      // left
+      lbl = *(label_ptr-1);
+    }
+    else {
+      lbl = *next_label;
+      parent_ptr[lbl] = lbl;
+      (*next_label)++;
+    }
+    
+    *label_ptr = lbl;
+    symbol++;
+    label_ptr++;
   }
   
-  *_max_label = current_label-1;
-    
-  free_label(&init_label);  
-  free_label(&_block_label);  
-  free_label(&_block_label_prev);
-  free_label(&label_mapping);
+  // estimate the runs from every 8th pixel, a full count costs as much as
+  // the run labelling saves
+  symbol -= width;
+  for(size_t x = 1; x < width; x += 8)
+    count += symbol[x] != symbol[x-1];
+  
+  return 8*count;
 }
 
-static void label_forward(const label_list *block_init_label, const size_t blocks_per_row,const size_t blocks_per_column,label_list *block_label) {
-  const size_t block_count = block_init_label->size;
+/**
+ * Collect the runs of an already labelled row.
+ */
+static inline void row_runs(const size_t width,const bsymbol* symbol,const blabel* label_ptr,blabel* start,blabel* run_label) {
+  size_t count = 0;
   
-  if(block_label->size != block_count) {    
-    allocate_label(block_label,block_count);
+  for(size_t x = 0; x < width; x++) {
+    if(x > 0 && symbol[x-1] == symbol[x])
+      continue;
+    
+    start[count] = x;
+    run_label[count] = label_ptr[x];
+    count++;
   }
   
-  blabel label = 1;
-  blabel* row_symbol_ptr = (blabel*)block_init_label->data_ptr;  
-  blabel* block_label_ptr = (blabel*)block_label->data_ptr;
-  
-  block_label->data_ptr[0] = label;
-  label++;
-  
-  blabel* symbol = row_symbol_ptr+1;
+  start[count] = width + 1;
+}
+
+/**
+ * Label one row run by run: a run takes the label of the first run of its
+ * symbol touching it (8-connectivity) in the row above and records
+ * equivalences with the others, so the union-find work scales with the
+ * number of runs. Returns the number of runs.
+ */
+static inline size_t label_row_runs(const size_t width,const bsymbol* symbol,blabel* label_ptr,blabel* parent_ptr,blabel* next_label,const blabel* prev_start,const blabel* prev_label,blabel* start,blabel* run_label,int (*run_length)(const bsymbol*,int)) {
+  const bsymbol* above = symbol - width;
+  size_t count = 0;
+  size_t first = 0;
+  size_t x0 = 0;
   
-  // top row
-  for(size_t x = 1; x < blocks_per_row; x++) {
+  while(x0 < width) {
+    const bsymbol sym = symbol[x0];
+    const size_t x1 = x0 + run_length(symbol + x0,width - x0);
+    blabel lbl = 0;
     
-    blabel lbl = block_label->data_ptr[x-1];
+    // runs above ending left of x0-1 touch neither this run nor the
+    // following ones
+    while(prev_start[first+1] < x0)
+      first++;
     
-    if(*symbol == *(symbol-1) && lbl != 0) {
-      block_label->data_ptr[x] = lbl;
+    for(size_t r = first; prev_start[r] <= x1; r++) {
+      if(above[prev_start[r]] != sym)
+	continue;
+      
+      if(lbl)
+	label_union(parent_ptr,lbl,prev_label[r]);
+      else
+	lbl = prev_label[r];
     }
-    else {				
-      block_label->data_ptr[x] = label;
-      label++;
+    
+    if(!lbl) {
+      lbl = *next_label;
+      parent_ptr[lbl] = lbl;
+      (*next_label)++;
     }
     
+    start[count] = x0;
+    run_label[count] = lbl;
+    count++;
     
-    symbol++;    
+    for(size_t x = x0; x < x1; x++)
+      label_ptr[x] = lbl;
+    x0 = x1;
   }
   
-  blabel* symbol_prev = row_symbol_ptr;
-  symbol = row_symbol_ptr + blocks_per_row;
+  return count;
+}
+
+/**
+ * First labelling pass over rows [slice_start, slice_end) of the symbol
+ * plane. Rows below a row of long runs are labelled run by run, the others
+ * pixel by pixel where the run bookkeeping would cost more than it saves;
+ * both leave the same regions. Provisional labels of a slice start at
+ * slice_start*width+1 so slices never share a label and labels still
+ * increase in raster order; rows above the slice are not looked at,
+ * label_merge() joins regions crossing slice borders.
+ */
+static void label_slice(const size_t width,size_t slice_start,size_t slice_end,size_t slice_index,label_table *table,label_list *block_label,int (*run_length)(const bsymbol*,int)) {
+  blabel* parent_ptr = table->parent.data_ptr;
+  blabel* run_ptr = table->run.data_ptr + slice_index*table->run_stride;
+  // run starts, closed by width+1 so that no run search leaves the row,
+  // and run labels
+  blabel* prev_start = run_ptr;
+  blabel* prev_label = run_ptr + (width+1);
+  blabel* cur_start = run_ptr + 2*(width+1);
+  blabel* cur_label = run_ptr + 3*(width+1);
+  blabel next_label = slice_start*width + 1;
+  size_t count = width;
+  bool runs = false;
   
-  // left column
-  for(size_t y = 1; y < blocks_per_column; y++) {
-    size_t index = y*blocks_per_row;
-    
+  for(size_t y = slice_start; y < slice_end; y++) {
+    const bsymbol* symbol = table->symbol.data_ptr + y*width;
+    blabel* label_ptr = block_label->data_ptr + y*width;
     
-    blabel lbl = block_label->data_ptr[index-blocks_per_row];
-    
-    if(*symbol == *(symbol_prev) && lbl != 0) {
-      block_label->data_ptr[index] = lbl;
-    }
-    else {				
-      block_label->data_ptr[index] = label;
-      label++;
+    if(y == slice_start || count > width/RUN_ROW_DIVISOR) {
+      count = label_row_pixels(width,symbol,label_ptr,y > slice_start,parent_ptr,&next_label);
+      runs = false;
+      continue;
     }
     
-    symbol_prev = symbol;
-    symbol += blocks_per_row;		
+    // switching to runs: the row above was labelled pixel by pixel
+    if(!runs)
+      row_runs(width,symbol-width,label_ptr-width,prev_start,prev_label);
+    
+    count = label_row_runs(width,symbol,label_ptr,parent_ptr,&next_label,prev_start,prev_label,cur_start,cur_label,run_length);
+    cur_start[count] = width + 1;
+    FFSWAP(blabel*,prev_start,cur_start);
+    FFSWAP(blabel*,prev_label,cur_label);
+    runs = true;
   }
   
-  blabel* label_ptr = block_label_ptr;
-  size_t blocks_per_row_lr = blocks_per_row-1;
-  
-  // body
+  table->slice_label.data_ptr[slice_index] = next_label;
+}
+
+/**
+ * Join regions across slice borders and number the regions consecutively
+ * in raster order of first appearance. Afterwards the parent table maps
+ * every provisional label directly to its final label.
+ */
+static void label_merge(const size_t height,const size_t width,label_table *table,label_list *block_label,size_t *_max_label) {
+  blabel* parent_ptr = table->parent.data_ptr;
+  const size_t slice_count = table->slice_count;
   
-  for(size_t y = 1; y < blocks_per_column; y++) {
-    symbol = row_symbol_ptr + y*blocks_per_row + 1;    
-    label_ptr = block_label_ptr + y*blocks_per_row + 1;
+  for(size_t s = 1; s < slice_count; s++) {
+    size_t y = height*s/slice_count;
+    bsymbol* symbol = table->symbol.data_ptr + y*width;
+    blabel* label_ptr = block_label->data_ptr + y*width;
     
-    for(size_t x = 1; x < blocks_per_row; x++) {
-      
-      // left
-      blabel lbl = *(label_ptr - 1);
-      bool assigned = false;
-      bool increment = false;
-      
-      if(*symbol == *(symbol-1) && lbl != 0) {
-	*label_ptr = lbl;
-	assigned = true;
-      }
-      else {		
-	assigned = true;
-	increment = true;
-	*label_ptr = label;	
-      }
-      
-      // top
-      lbl = *(label_ptr-blocks_per_row);
-      
-      if(*symbol == *(symbol-blocks_per_row) && lbl != 0) {
-	if(*label_ptr == 0) {
-	  *label_ptr = lbl;
-	  assigned = true;
-	}
-	else if(lbl < *label_ptr) {
-	  *label_ptr = lbl;
-	  assigned = true;
-	}
-	
-	increment = false;
-      }
-      else if(!assigned){		
-	assigned = true;
-	increment = true;
-	*label_ptr = label;	
-      }
+    for(size_t x = 0; x < width; x++) {
+      bsymbol sym = symbol[x];
       
-      // top left
-      lbl = *(label_ptr-blocks_per_row-1);
+      if(x > 0 && *(symbol+x-width-1) == sym)
+	label_union(parent_ptr,label_ptr[x],*(label_ptr+x-width-1));
       
-      if(*symbol == *(symbol-blocks_per_row-1) && lbl != 0) {
-	if(*label_ptr == 0) {
-	  *label_ptr = lbl;
-	  assigned = true;
-	}
-	else if(lbl < *label_ptr) {
-	  *label_ptr = lbl;
-	  assigned = true;
-	}
-	
-	increment = false;
-      }
-      else if(!assigned){	
-	increment = true;
-	*label_ptr = label;	
-      }
+      if(*(symbol+x-width) == sym)
+	label_union(parent_ptr,label_ptr[x],*(label_ptr+x-width));
       
-      if(x < blocks_per_row_lr) {
-	// top right
-	lbl = *(label_ptr-blocks_per_row+1);
-	
-	if(*symbol == *(symbol-blocks_per_row+1) && lbl != 0) {
-	  if(*label_ptr == 0) {
-	    *label_ptr = lbl;
-	    assigned = true;
-	  }
-	  else if(lbl < *label_ptr) {
-	    *label_ptr = lbl;
-	    assigned = true;
-	  }
-	  
-	  increment = false;
-	}
-	else if(!assigned){	
-	  increment = true;
-	  *label_ptr = label;	  
-	}
+      if(x < width-1 && *(symbol+x-width+1) == sym)
+	label_union(parent_ptr,label_ptr[x],*(label_ptr+x-width+1));
+    }
+  }
+  
+  // a root is the smallest provisional label of its region, which is the
+  // label of its first pixel; parents always precede their children so an
+  // ascending walk replaces each entry by the final label of its root
+  blabel current_label = 1;
+  
+  for(size_t s = 0; s < slice_count; s++) {
+    blabel lbl = height*s/slice_count*width + 1;
+    blabel lbl_end = table->slice_label.data_ptr[s];
+    
+    for(; lbl < lbl_end; lbl++) {
+      if(parent_ptr[lbl] == lbl) {
+	parent_ptr[lbl] = current_label;
+	current_label++;
       }
-      
-      
-      if(increment) {
-	label++;
+      else {
+	parent_ptr[lbl] = parent_ptr[parent_ptr[lbl]];
       }
-      
-      
-      symbol++;      
-      label_ptr++;
-    }	
+    }
   }
+  
+  *_max_label = current_label-1;
 }
 
-static void label_backward(const label_list *block_init_label, const size_t blocks_per_row,const size_t blocks_per_column,label_list *block_label) {
-  const size_t block_count = block_label->size;
-  
-  blabel* block_label_ptr = (blabel*)block_label->data_ptr;
-  blabel* row_symbol_ptr = (blabel*)block_init_label->data_ptr;
-  
-  int offset = blocks_per_row*(blocks_per_column-2) + blocks_per_row - 1;
-  
-  blabel* label_ptr = block_label_ptr + offset;
-  blabel* symbol = row_symbol_ptr + offset;
-  
-  // right column
-  for(int y = blocks_per_column-2; y >= 0; y--) {
-    
-    blabel lbl = *(label_ptr + blocks_per_row);
-    
-    if(*symbol == *(symbol+blocks_per_row) && lbl != 0) {
-      if(lbl < *label_ptr) {
-	*label_ptr = lbl;
-      }
-    }
-    
-    lbl = *(label_ptr + blocks_per_row - 1);
-    
-    if(*symbol == *(symbol+blocks_per_row-1) && lbl != 0) {
-      if(lbl < *label_ptr) {
-	*label_ptr = lbl;
-      }
-    }
-    
-    label_ptr -= blocks_per_row;
-    symbol -= blocks_per_row;		
-  }
-  
-  // bottom row
-  offset = blocks_per_row*(blocks_per_column-1) + blocks_per_row - 2;
-  label_ptr = block_label_ptr + offset;
-  symbol = row_symbol_ptr + offset;
-   
-  for(int x = blocks_per_row-2; x >= 0; x--) {
-    
-    blabel lbl = *(label_ptr + 1);
-    
-    if(*symbol == *(symbol+1) && lbl != 0) {
-      if(lbl < *label_ptr)
-	*label_ptr = lbl;
-    }
-    
-    
-    label_ptr--;
-    symbol--;    
-  }
+/**
+ * Second labelling pass over rows [slice_start, slice_end): replace the
+ * provisional labels by the final ones.
+ */
+static void label_resolve(const size_t width,size_t slice_start,size_t slice_end,label_table *table,label_list *block_label) {
+  blabel* parent_ptr = table->parent.data_ptr;
+  blabel* label_ptr = block_label->data_ptr + slice_start*width;
+  blabel* label_end = block_label->data_ptr + slice_end*width;
   
-  // body
-  for(int y = blocks_per_column-2; y >= 0; y--) {
-    offset = blocks_per_row*y + blocks_per_row - 2;
-    symbol = row_symbol_ptr + offset;    
-    label_ptr = block_label_ptr + offset;
-    
-    for(int x = blocks_per_row-2; x >= 0; x--) {
-      // right
-      int lbl = *(label_ptr + 1);
-      
-      if(*symbol == *(symbol+1) && lbl != 0) {
-	if(lbl < *label_ptr)
-	  *label_ptr = lbl;
-      }
-      // below
-      lbl = *(label_ptr + blocks_per_row);
-      
-      if(*symbol == *(symbol+blocks_per_row) && lbl != 0) {
-	if(lbl < *label_ptr)
-	  *label_ptr = lbl;
-      }
-      // below right
-      lbl = *(label_ptr + blocks_per_row + 1);
-      
-      if(*symbol == *(symbol+blocks_per_row+1) && lbl != 0) {
-	if(lbl < *label_ptr)
-	  *label_ptr = lbl;
-      }
-      
-      if(x > 0) {
-	// below left
-	lbl = *(label_ptr + blocks_per_row - 1);
-	
-	if(*symbol == *(symbol+blocks_per_row-1) && lbl != 0) {
-	  if(lbl < *label_ptr)
-	    *label_ptr = lbl;
-	}
-      }
-      
-      symbol--;      
-      label_ptr--;
-    }
-  }
+  for(; label_ptr < label_end; label_ptr++)
+    *label_ptr = parent_ptr[*label_ptr];
 }
 
-static void label_distance(const size_t height,const size_t width,label_list *block_label,size_t max_label,label_list_collection *min_field) {
+/**
+ * Nearest (a) and second nearest (b) foreign label and their chamfer
+ * distance for every pixel, kept in one interleaved record per pixel so
+ * a sweep streams a single plane besides the labels. label_change is a
+ * scratch plane of the frame size.
+ *
+ * Labels further than max_distance are never taken, so the sweeps stop
+ * once every pixel has settled within that radius or after max_passes
+ * sweep pairs. Pixels with no foreign label in range keep label_a = 0.
+ */
+static void label_distance(const size_t height,const size_t width,label_list *block_label,size_t max_label,int max_distance,int max_passes,distance_list *distance_field,label_list *label_change) {
   const int D1 = 5;
   const int D2 = 7;
   
-  const size_t MAX_LBL = width*height;
   size_t img_size = block_label->size;
   
-
-  blabel* min_dist_a_ptr = min_field->data_ptr1;
-  blabel* min_dist_b_ptr = min_field->data_ptr3;
-  blabel* label_a_ptr = min_field->data_ptr0;
-  blabel* label_b_ptr = min_field->data_ptr2;
-  
-  label_list guard_a; //(img_size);
-  label_list guard_b; //(img_size);
-  allocate_label(&guard_a,img_size);
-  allocate_label(&guard_b,img_size);
+  DebandDistance* distance_ptr = distance_field->data_ptr;
   
-  label_list label_change; //(img_size);
-  allocate_label(&label_change,img_size);
+  // guards are only read where the matching label is set, the change
+  // plane has to start out different from any labelling but all zeros
+  blabel* label_change_ptr = label_change->data_ptr;
   
-  blabel* guard_a_ptr = guard_a.data_ptr;
-  blabel* guard_b_ptr = guard_b.data_ptr;
+  memset(label_change_ptr,0,img_size*sizeof(blabel));
   
   for(size_t p = 0; p < img_size; p++) {
-    min_dist_a_ptr[p] = MAX_LBL;
-    min_dist_b_ptr[p] = MAX_LBL;
-    label_a_ptr[p] = 0;
-    label_b_ptr[p] = 0;
+    distance_ptr[p].dist_a = DIST_MAX;
+    distance_ptr[p].dist_b = DIST_MAX;
+    distance_ptr[p].label_a = 0;
+    distance_ptr[p].label_b = 0;
   }
   
   blabel* block_label_ptr = block_label->data_ptr;
   blabel* pel_ptr = NULL;
-  blabel* dist_ptr = NULL;
+  uint16_t* dist_ptr = NULL;
   blabel* guard_ptr = NULL;
   size_t offset = 0;
   size_t offset_upper = 0;
@@ -438,34 +415,29 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
   blabel local_guard_ne[ForwardNE_NCNE];
   blabel local_dist_ne[ForwardNE_NCNE];
   
-  while(1) {    
+  for(int pass = 0; pass < max_passes; pass++) {
     // forward
     //y = 0
     {
       memset(local_label_ne,0,sizeof(local_label_ne));
       blabel* bl_ptr = block_label_ptr+1;		// init rgb label
-      blabel* ma_ptr = min_dist_a_ptr+1; 
-      blabel* la_ptr = label_a_ptr+1;		
-      blabel* ga_ptr = guard_a_ptr+1;
-      
-      blabel* mb_ptr = min_dist_b_ptr+1;		
-      blabel* lb_ptr = label_b_ptr+1;		
-      blabel* gb_ptr = guard_b_ptr+1;
+      DebandDistance* rec_ptr = distance_ptr + 1;
       
       for(size_t x = 1; x < width; x++) {
 	local_label[Forward_CP] = *bl_ptr;
-	local_dist[Forward_CP] = *ma_ptr;
+	local_dist[Forward_CP] = rec_ptr->dist_a;
 	
 	local_label[Forward_LM] = Forward_NV;
+	local_label_ne[ForwardNE_NVNE] = ForwardNE_NVNE;
 	local_label_ne[ForwardNE_LMA] = ForwardNE_NVNE;
 	local_label_ne[ForwardNE_LMB] = ForwardNE_NVNE;
 	
-	local_label_ne[ForwardNE_CA] = *la_ptr;
-	local_dist_ne[ForwardNE_CA] = *ma_ptr;
-	local_guard_ne[ForwardNE_CA] = *ga_ptr;
-	local_label_ne[ForwardNE_CB] = *lb_ptr;
-	local_dist_ne[ForwardNE_CB] = *mb_ptr;
-	local_guard_ne[ForwardNE_CB] = *gb_ptr;
+	local_label_ne[ForwardNE_CA] = rec_ptr->label_a;
+	local_dist_ne[ForwardNE_CA] = rec_ptr->dist_a;
+	local_guard_ne[ForwardNE_CA] = rec_ptr->guard_a;
+	local_label_ne[ForwardNE_CB] = rec_ptr->label_b;
+	local_dist_ne[ForwardNE_CB] = rec_ptr->dist_b;
+	local_guard_ne[ForwardNE_CB] = rec_ptr->guard_b;
 	
 	// left
 	pel_ptr = bl_ptr-1;
@@ -476,9 +448,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	}
 	
 	// left ocean a
-	pel_ptr = la_ptr-1;
-	dist_ptr = ma_ptr-1;
-	guard_ptr = ga_ptr-1;
+	pel_ptr = &(rec_ptr-1)->label_a;
+	dist_ptr = &(rec_ptr-1)->dist_a;
+	guard_ptr = &(rec_ptr-1)->guard_a;
 	
 	if(*pel_ptr != local_label[Forward_CP]) {
 	  local_label_ne[ForwardNE_LMA] = *pel_ptr;
@@ -487,9 +459,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	}
 	
 	// left ocean b
-	pel_ptr = lb_ptr-1;
-	dist_ptr = mb_ptr-1;
-	guard_ptr = gb_ptr-1;
+	pel_ptr = &(rec_ptr-1)->label_b;
+	dist_ptr = &(rec_ptr-1)->dist_b;
+	guard_ptr = &(rec_ptr-1)->guard_b;
 	
 	if(*pel_ptr != local_label[Forward_CP]) {
 	  local_label_ne[ForwardNE_LMB] = *pel_ptr;
@@ -512,7 +484,7 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	blabel _lb = 0;
 	
 	for(size_t n = ForwardNE_NVNE; n <= ForwardNE_LMB; n++) {
-	  if(local_label_ne[n] != ForwardNE_NVNE && local_guard_ne[n] == local_label[Forward_CP]) {
+	  if(local_label_ne[n] != ForwardNE_NVNE && local_guard_ne[n] == local_label[Forward_CP] && local_dist_ne[n] <= max_distance) {
 	    if(local_dist_ne[n] < min_d_a) {   
 	      min_d_a = local_dist_ne[n];
 	      _ga = local_guard_ne[n];
@@ -523,7 +495,7 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	
 	// min b
 	for(size_t n = ForwardNE_NVNE; n <= ForwardNE_RUB; n++) {
-	  if(local_label_ne[n] != ForwardNE_NVNE && local_guard_ne[n] == local_label[Forward_CP]) {
+	  if(local_label_ne[n] != ForwardNE_NVNE && local_guard_ne[n] == local_label[Forward_CP] && local_dist_ne[n] <= max_distance) {
 	    if(local_dist_ne[n] < min_d_b && local_label_ne[n] != _la) {	      
 	      min_d_b = local_dist_ne[n];
 	      _gb = local_guard_ne[n];
@@ -533,21 +505,16 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	}
 	// check a & b
-	*ma_ptr = min_d_a;
-	*ga_ptr = _ga;
-	*la_ptr = _la;
+	rec_ptr->dist_a = FFMIN(min_d_a,DIST_MAX);
+	rec_ptr->guard_a = _ga;
+	rec_ptr->label_a = _la;
 	
-	*mb_ptr = min_d_b;
-	*gb_ptr = _gb;
-	*lb_ptr = _lb;
+	rec_ptr->dist_b = FFMIN(min_d_b,DIST_MAX);
+	rec_ptr->guard_b = _gb;
+	rec_ptr->label_b = _lb;
 	
 	bl_ptr++;			
-	ga_ptr++;
-	la_ptr++;
-	ma_ptr++;
-	gb_ptr++;
-	lb_ptr++;
-	mb_ptr++;
+	rec_ptr++;
       }
     }
     
@@ -558,26 +525,15 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
       
       blabel* bl_ptr = block_label_ptr + offset;
       blabel* blu_ptr = block_label_ptr + offset_upper;
-      blabel* ma_ptr = min_dist_a_ptr + offset;
-      blabel* mau_ptr = min_dist_a_ptr + offset_upper;
-      blabel* la_ptr = label_a_ptr + offset;
-      blabel* lau_ptr = label_a_ptr + offset_upper;
-      blabel* ga_ptr = guard_a_ptr + offset;
-      blabel* gau_ptr = guard_a_ptr + offset_upper;
-      
-      blabel* mb_ptr = min_dist_b_ptr + offset;
-      blabel* mbu_ptr = min_dist_b_ptr + offset_upper;
-      blabel* lb_ptr = label_b_ptr + offset;
-      blabel* lbu_ptr = label_b_ptr + offset_upper;
-      blabel* gb_ptr = guard_b_ptr + offset;
-      blabel* gbu_ptr = guard_b_ptr + offset_upper;
+      DebandDistance* rec_ptr = distance_ptr + offset;
+      DebandDistance* rec_up_ptr = distance_ptr + offset_upper;
       
       bool edge = false;
       blabel dir_sel = Forward_NV;
       
       for(size_t x = 0; x < width; x++) {
 	local_label[Forward_CP] = *bl_ptr;
-	local_dist[Forward_CP] = *ma_ptr;
+	local_dist[Forward_CP] = rec_ptr->dist_a;
 	edge = false;
 	// edge test
 	local_label[Forward_LM] = Forward_NV;
@@ -585,12 +541,12 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	local_label[Forward_RU] = Forward_NV;
 	local_label[Forward_MU] = Forward_NV;
 	
-	local_label_ne[ForwardNE_CA] = *la_ptr;
-	local_dist_ne[ForwardNE_CA] = *ma_ptr;
-	local_guard_ne[ForwardNE_CA] = *ga_ptr;
-	local_label_ne[ForwardNE_CB] = *lb_ptr;
-	local_dist_ne[ForwardNE_CB] = *mb_ptr;
-	local_guard_ne[ForwardNE_CB] = *gb_ptr;
+	local_label_ne[ForwardNE_CA] = rec_ptr->label_a;
+	local_dist_ne[ForwardNE_CA] = rec_ptr->dist_a;
+	local_guard_ne[ForwardNE_CA] = rec_ptr->guard_a;
+	local_label_ne[ForwardNE_CB] = rec_ptr->label_b;
+	local_dist_ne[ForwardNE_CB] = rec_ptr->dist_b;
+	local_guard_ne[ForwardNE_CB] = rec_ptr->guard_b;
 	
 	// ocean test
 	local_label_ne[ForwardNE_NVNE] = ForwardNE_NVNE;
@@ -623,9 +579,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }	
 	  
 	  // left ocean a
-	  pel_ptr = la_ptr-1;
-	  dist_ptr = ma_ptr-1;
-	  guard_ptr = ga_ptr-1;
+	  pel_ptr = &(rec_ptr-1)->label_a;
+	  dist_ptr = &(rec_ptr-1)->dist_a;
+	  guard_ptr = &(rec_ptr-1)->guard_a;
 	  
 	  if(*pel_ptr != local_label[Forward_CP]) {
 	    local_label_ne[ForwardNE_LMA] = *pel_ptr;
@@ -634,9 +590,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	  
 	  // left ocean b
-	  pel_ptr = lb_ptr-1;
-	  dist_ptr = mb_ptr-1;
-	  guard_ptr = gb_ptr-1;
+	  pel_ptr = &(rec_ptr-1)->label_b;
+	  dist_ptr = &(rec_ptr-1)->dist_b;
+	  guard_ptr = &(rec_ptr-1)->guard_b;
 	  
 	  if(*pel_ptr != local_label[Forward_CP]) {
 	    local_label_ne[ForwardNE_LMB] = *pel_ptr;
@@ -645,9 +601,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	  
 	  // left upper ocean a
-	  pel_ptr = lau_ptr-1;
-	  dist_ptr = mau_ptr-1;
-	  guard_ptr = gau_ptr-1;
+	  pel_ptr = &(rec_up_ptr-1)->label_a;
+	  dist_ptr = &(rec_up_ptr-1)->dist_a;
+	  guard_ptr = &(rec_up_ptr-1)->guard_a;
 	  
 	  if(*pel_ptr != local_label[Forward_CP]) {
 	    local_label_ne[ForwardNE_LUA] = *pel_ptr;
@@ -656,9 +612,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	  
 	  // left upper ocean b
-	  pel_ptr = lbu_ptr-1;
-	  dist_ptr = mbu_ptr-1;
-	  guard_ptr = gbu_ptr-1;
+	  pel_ptr = &(rec_up_ptr-1)->label_b;
+	  dist_ptr = &(rec_up_ptr-1)->dist_b;
+	  guard_ptr = &(rec_up_ptr-1)->guard_b;
 	  
 	  if(*pel_ptr != local_label[Forward_CP]) {
 	    local_label_ne[ForwardNE_LUB] = *pel_ptr;
@@ -678,9 +634,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }	
 	  
 	  // right upper ocean a
-	  pel_ptr = lau_ptr+1;
-	  dist_ptr = mau_ptr+1;
-	  guard_ptr = gau_ptr+1;
+	  pel_ptr = &(rec_up_ptr+1)->label_a;
+	  dist_ptr = &(rec_up_ptr+1)->dist_a;
+	  guard_ptr = &(rec_up_ptr+1)->guard_a;
 	  
 	  if(*pel_ptr != local_label[Forward_CP]) {
 	    local_label_ne[ForwardNE_RUA] = *pel_ptr;
@@ -689,9 +645,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	  
 	  // right upper ocean b
-	  pel_ptr = lbu_ptr+1;
-	  dist_ptr = mbu_ptr+1;
-	  guard_ptr = gbu_ptr+1;
+	  pel_ptr = &(rec_up_ptr+1)->label_b;
+	  dist_ptr = &(rec_up_ptr+1)->dist_b;
+	  guard_ptr = &(rec_up_ptr+1)->guard_b;
 	  
 	  if(*pel_ptr != local_label[Forward_CP]) {
 	    local_label_ne[ForwardNE_RUB] = *pel_ptr;
@@ -710,9 +666,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	}
 	
 	// upper ocean a
-	pel_ptr = lau_ptr;
-	dist_ptr = mau_ptr;
-	guard_ptr = gau_ptr;
+	pel_ptr = &rec_up_ptr->label_a;
+	dist_ptr = &rec_up_ptr->dist_a;
+	guard_ptr = &rec_up_ptr->guard_a;
 	
 	if(*pel_ptr != local_label[Forward_CP]) {
 	  local_label_ne[ForwardNE_MUA] = *pel_ptr;
@@ -721,9 +677,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	}
 	
 	// upper ocean b
-	pel_ptr = lbu_ptr;
-	dist_ptr = mbu_ptr;
-	guard_ptr = gbu_ptr;
+	pel_ptr = &rec_up_ptr->label_b;
+	dist_ptr = &rec_up_ptr->dist_b;
+	guard_ptr = &rec_up_ptr->guard_b;
 	
 	if(*pel_ptr != local_label[Forward_CP]) {
 	  local_label_ne[ForwardNE_MUB] = *pel_ptr;
@@ -789,7 +745,7 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	blabel _lb = 0;
 	
 	for(size_t n = ForwardNE_NVNE; n <= ForwardNE_RUB; n++) {
-	  if(local_label_ne[n] != ForwardNE_NVNE && local_guard_ne[n] == local_label[Forward_CP]) {
+	  if(local_label_ne[n] != ForwardNE_NVNE && local_guard_ne[n] == local_label[Forward_CP] && local_dist_ne[n] <= max_distance) {
 	    if(local_dist_ne[n] < min_d_a) {
 	      min_d_a = local_dist_ne[n];
 	      _ga = local_guard_ne[n];
@@ -800,7 +756,7 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	
 	// min b
 	for(size_t n = ForwardNE_NVNE; n <= ForwardNE_RUB; n++) {
-	  if(local_label_ne[n] != ForwardNE_NVNE && local_guard_ne[n] == local_label[Forward_CP]) {
+	  if(local_label_ne[n] != ForwardNE_NVNE && local_guard_ne[n] == local_label[Forward_CP] && local_dist_ne[n] <= max_distance) {
 	    if(local_dist_ne[n] < min_d_b && local_label_ne[n] != _la) {
 	      min_d_b = local_dist_ne[n];
 	      _gb = local_guard_ne[n];
@@ -809,30 +765,20 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	}
 	// check a & b
-	*ma_ptr = min_d_a;
-	*ga_ptr = _ga;
-	*la_ptr = _la;
+	rec_ptr->dist_a = FFMIN(min_d_a,DIST_MAX);
+	rec_ptr->guard_a = _ga;
+	rec_ptr->label_a = _la;
 	
-	*mb_ptr = min_d_b;
-	*gb_ptr = _gb;
-	*lb_ptr = _lb;
+	rec_ptr->dist_b = FFMIN(min_d_b,DIST_MAX);
+	rec_ptr->guard_b = _gb;
+	rec_ptr->label_b = _lb;
 	
 	bl_ptr++;			
-	ga_ptr++;
-	la_ptr++;
-	ma_ptr++;
-	gb_ptr++;
-	lb_ptr++;
-	mb_ptr++;
+	rec_ptr++;
 	
 	//upper
 	blu_ptr++;			
-	gau_ptr++;
-	lau_ptr++;
-	mau_ptr++;
-	gbu_ptr++;
-	lbu_ptr++;
-	mbu_ptr++;
+	rec_up_ptr++;
 	
       }
     }
@@ -848,27 +794,23 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
       size_t rev_offset = height*width - 2;
       
       blabel* bl_ptr = block_label_ptr+rev_offset;		// init rgb label
-      blabel* ma_ptr = min_dist_a_ptr+rev_offset; 
-      blabel* la_ptr = label_a_ptr+rev_offset;		
-      blabel* ga_ptr = guard_a_ptr+rev_offset;
-      
-      blabel* mb_ptr = min_dist_b_ptr+rev_offset;		
-      blabel* lb_ptr = label_b_ptr+rev_offset;		
-      blabel* gb_ptr = guard_b_ptr+rev_offset;
+      DebandDistance* rec_ptr = distance_ptr + rev_offset;
       
-      for(int x = width_end; x >= 0; x--) {
+      // the last pixel has nothing to its right
+      for(int x = width_end - 1; x >= 0; x--) {
 	local_label[Reverse_CPR] = *bl_ptr;
 	
 	local_label[Reverse_RM] = Reverse_NVR;
+	local_label_ne[ReverseNE_NVRNE] = ReverseNE_NVRNE;
 	local_label_ne[ReverseNE_RMA] = ReverseNE_NVRNE;
 	local_label_ne[ReverseNE_RMB] = ReverseNE_NVRNE;
 	
-	local_label_ne[ReverseNE_CAR] = *la_ptr;
-	local_dist_ne[ReverseNE_CAR] = *ma_ptr;
-	local_guard_ne[ReverseNE_CAR] = *ga_ptr;
-	local_label_ne[ReverseNE_CBR] = *lb_ptr;
-	local_dist_ne[ReverseNE_CBR] = *mb_ptr;
-	local_guard_ne[ReverseNE_CBR] = *gb_ptr;
+	local_label_ne[ReverseNE_CAR] = rec_ptr->label_a;
+	local_dist_ne[ReverseNE_CAR] = rec_ptr->dist_a;
+	local_guard_ne[ReverseNE_CAR] = rec_ptr->guard_a;
+	local_label_ne[ReverseNE_CBR] = rec_ptr->label_b;
+	local_dist_ne[ReverseNE_CBR] = rec_ptr->dist_b;
+	local_guard_ne[ReverseNE_CBR] = rec_ptr->guard_b;
 	
 	// right
 	pel_ptr = bl_ptr+1;
@@ -879,9 +821,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	}
 	
 	// right ocean a
-	pel_ptr = la_ptr+1;
-	dist_ptr = ma_ptr+1;
-	guard_ptr = ga_ptr+1;
+	pel_ptr = &(rec_ptr+1)->label_a;
+	dist_ptr = &(rec_ptr+1)->dist_a;
+	guard_ptr = &(rec_ptr+1)->guard_a;
 	
 	if(*pel_ptr != local_label[Reverse_CPR]) {
 	  local_label_ne[ReverseNE_RMA] = *pel_ptr;
@@ -890,9 +832,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	}
 	
 	// right ocean b
-	pel_ptr = lb_ptr+1;
-	dist_ptr = mb_ptr+1;
-	guard_ptr = gb_ptr+1;
+	pel_ptr = &(rec_ptr+1)->label_b;
+	dist_ptr = &(rec_ptr+1)->dist_b;
+	guard_ptr = &(rec_ptr+1)->guard_b;
 	
 	if(*pel_ptr != local_label[Reverse_CPR]) {
 	  local_label_ne[ReverseNE_RMB] = *pel_ptr;
@@ -916,7 +858,7 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	blabel _lb = 0;
 	
 	for(size_t n = ReverseNE_NVRNE; n <= ReverseNE_RMB; n++) {
-	  if(local_label_ne[n] != ReverseNE_NVRNE && local_guard_ne[n] == local_label[Reverse_CPR]) {
+	  if(local_label_ne[n] != ReverseNE_NVRNE && local_guard_ne[n] == local_label[Reverse_CPR] && local_dist_ne[n] <= max_distance) {
 	    if(local_dist_ne[n] < min_d_a) {
 	      min_d_a = local_dist_ne[n];
 	      _ga = local_guard_ne[n];
@@ -927,7 +869,7 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	
 	// min b
 	for(size_t n = ReverseNE_NVRNE; n <= ReverseNE_RBB; n++) {
-	  if(local_label_ne[n] != ReverseNE_NVRNE && local_guard_ne[n] == local_label[Reverse_CPR]) {
+	  if(local_label_ne[n] != ReverseNE_NVRNE && local_guard_ne[n] == local_label[Reverse_CPR] && local_dist_ne[n] <= max_distance) {
 	    if(local_dist_ne[n] < min_d_b && local_label_ne[n] != _la) {
 	      min_d_b = local_dist_ne[n];
 	      _gb = local_guard_ne[n];
@@ -937,21 +879,16 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	}
 	// check a & b
 	
-	*ma_ptr = min_d_a;
-	*ga_ptr = _ga;
-	*la_ptr = _la;
-	*mb_ptr = min_d_b;
-	*gb_ptr = _gb;
-	*lb_ptr = _lb;
+	rec_ptr->dist_a = FFMIN(min_d_a,DIST_MAX);
+	rec_ptr->guard_a = _ga;
+	rec_ptr->label_a = _la;
+	rec_ptr->dist_b = FFMIN(min_d_b,DIST_MAX);
+	rec_ptr->guard_b = _gb;
+	rec_ptr->label_b = _lb;
 	
 	
 	bl_ptr--;
-	ma_ptr--;
-	la_ptr--;
-	ga_ptr--;
-	mb_ptr--;
-	lb_ptr--;
-	gb_ptr--;
+	rec_ptr--;
       }
     }
     // y = height-2 -> y=0
@@ -961,19 +898,8 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
       
       blabel* bl_ptr = block_label_ptr + offset;
       blabel* blb_ptr = block_label_ptr + offset_upper;
-      blabel* ma_ptr = min_dist_a_ptr + offset;
-      blabel* mab_ptr = min_dist_a_ptr + offset_upper;
-      blabel* la_ptr = label_a_ptr + offset;
-      blabel* lab_ptr = label_a_ptr + offset_upper;
-      blabel* ga_ptr = guard_a_ptr + offset;
-      blabel* gab_ptr = guard_a_ptr + offset_upper;
-      
-      blabel* mb_ptr = min_dist_b_ptr + offset;
-      blabel* mbb_ptr = min_dist_b_ptr + offset_upper;
-      blabel* lb_ptr = label_b_ptr + offset;
-      blabel* lbb_ptr = label_b_ptr + offset_upper;
-      blabel* gb_ptr = guard_b_ptr + offset;
-      blabel* gbb_ptr = guard_b_ptr + offset_upper;
+      DebandDistance* rec_ptr = distance_ptr + offset;
+      DebandDistance* rec_dn_ptr = distance_ptr + offset_upper;
       bool edge = false;
       blabel dir_sel = Reverse_NVR;
       
@@ -985,12 +911,12 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	local_label[Reverse_MB] = Reverse_NVR;
 	local_label[Reverse_RB] = Reverse_NVR;
 	
-	local_label_ne[ReverseNE_CAR] = *la_ptr;
-	local_dist_ne[ReverseNE_CAR] = *ma_ptr;
-	local_guard_ne[ReverseNE_CAR] = *ga_ptr;
-	local_label_ne[ReverseNE_CBR] = *lb_ptr;
-	local_dist_ne[ReverseNE_CBR] = *mb_ptr;
-	local_guard_ne[ReverseNE_CBR] = *gb_ptr;
+	local_label_ne[ReverseNE_CAR] = rec_ptr->label_a;
+	local_dist_ne[ReverseNE_CAR] = rec_ptr->dist_a;
+	local_guard_ne[ReverseNE_CAR] = rec_ptr->guard_a;
+	local_label_ne[ReverseNE_CBR] = rec_ptr->label_b;
+	local_dist_ne[ReverseNE_CBR] = rec_ptr->dist_b;
+	local_guard_ne[ReverseNE_CBR] = rec_ptr->guard_b;
 	
 	local_label_ne[ReverseNE_NVRNE] = ReverseNE_NVRNE;
 	local_label_ne[ReverseNE_NARNE] = ReverseNE_NVRNE;
@@ -1016,9 +942,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	  
 	  // bottom left ocean a
-	  pel_ptr = lab_ptr - 1;
-	  dist_ptr = mab_ptr - 1;
-	  guard_ptr = gab_ptr - 1;
+	  pel_ptr = &(rec_dn_ptr-1)->label_a;
+	  dist_ptr = &(rec_dn_ptr-1)->dist_a;
+	  guard_ptr = &(rec_dn_ptr-1)->guard_a;
 	  
 	  if(*pel_ptr != local_label[Reverse_CPR]) {
 	    local_label_ne[ReverseNE_LBA] = *pel_ptr;
@@ -1027,9 +953,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	  
 	  // bottom left ocean b
-	  pel_ptr = lbb_ptr - 1;
-	  dist_ptr = mbb_ptr - 1;
-	  guard_ptr = gbb_ptr - 1;
+	  pel_ptr = &(rec_dn_ptr-1)->label_b;
+	  dist_ptr = &(rec_dn_ptr-1)->dist_b;
+	  guard_ptr = &(rec_dn_ptr-1)->guard_b;
 	  
 	  if(*pel_ptr != local_label[Reverse_CPR]) {
 	    local_label_ne[ReverseNE_LBB] = *pel_ptr;
@@ -1053,15 +979,15 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  pel_ptr = blb_ptr + 1;
 	  
 	  if(*pel_ptr != local_label[Reverse_CPR]) { 
-	    local_label[Reverse_LB] = *pel_ptr;
-	    local_dist[Reverse_LB] = D2;
+	    local_label[Reverse_RB] = *pel_ptr;
+	    local_dist[Reverse_RB] = D2;
 	    edge = true;
 	  }
 	  
 	  // right ocean a
-	  pel_ptr = la_ptr + 1;
-	  dist_ptr = ma_ptr + 1;
-	  guard_ptr = ga_ptr + 1;
+	  pel_ptr = &(rec_ptr+1)->label_a;
+	  dist_ptr = &(rec_ptr+1)->dist_a;
+	  guard_ptr = &(rec_ptr+1)->guard_a;
 	  
 	  if(*pel_ptr != local_label[Reverse_CPR]) {
 	    local_label_ne[ReverseNE_RMA] = *pel_ptr;
@@ -1070,9 +996,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	  
 	  // right ocean b
-	  pel_ptr = lb_ptr + 1;
-	  dist_ptr = mb_ptr + 1;
-	  guard_ptr = gb_ptr + 1;
+	  pel_ptr = &(rec_ptr+1)->label_b;
+	  dist_ptr = &(rec_ptr+1)->dist_b;
+	  guard_ptr = &(rec_ptr+1)->guard_b;
 	  
 	  if(*pel_ptr != local_label[Reverse_CPR]) {
 	    local_label_ne[ReverseNE_RMB] = *pel_ptr;
@@ -1082,9 +1008,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  
 	  
 	  // right bottom ocean a
-	  pel_ptr = lab_ptr + 1;
-	  dist_ptr = mab_ptr + 1;
-	  guard_ptr = gab_ptr + 1;
+	  pel_ptr = &(rec_dn_ptr+1)->label_a;
+	  dist_ptr = &(rec_dn_ptr+1)->dist_a;
+	  guard_ptr = &(rec_dn_ptr+1)->guard_a;
 	  
 	  if(*pel_ptr != local_label[Reverse_CPR]) {
 	    local_label_ne[ReverseNE_RBA] = *pel_ptr;
@@ -1093,9 +1019,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	  }
 	  
 	  // right bottom ocean b
-	  pel_ptr = lbb_ptr + 1;
-	  dist_ptr = mbb_ptr + 1;
-	  guard_ptr = gbb_ptr + 1;
+	  pel_ptr = &(rec_dn_ptr+1)->label_b;
+	  dist_ptr = &(rec_dn_ptr+1)->dist_b;
+	  guard_ptr = &(rec_dn_ptr+1)->guard_b;
 	  
 	  if(*pel_ptr != local_label[Reverse_CPR]) {
 	    local_label_ne[ReverseNE_RBB] = *pel_ptr;
@@ -1114,9 +1040,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	}
 	
 	// below ocean a
-	pel_ptr = lab_ptr;
-	dist_ptr = mab_ptr;
-	guard_ptr = gab_ptr;
+	pel_ptr = &rec_dn_ptr->label_a;
+	dist_ptr = &rec_dn_ptr->dist_a;
+	guard_ptr = &rec_dn_ptr->guard_a;
 	
 	if(*pel_ptr != local_label[Reverse_CPR]) {
 	  local_label_ne[ReverseNE_MBA] = *pel_ptr;
@@ -1125,9 +1051,9 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	}
 	
 	// below ocean b
-	pel_ptr = lbb_ptr;
-	dist_ptr = mbb_ptr;
-	guard_ptr = gbb_ptr;
+	pel_ptr = &rec_dn_ptr->label_b;
+	dist_ptr = &rec_dn_ptr->dist_b;
+	guard_ptr = &rec_dn_ptr->guard_b;
 	
 	if(*pel_ptr != local_label[Reverse_CPR]) {
 	  local_label_ne[ReverseNE_MBB] = *pel_ptr;
@@ -1159,269 +1085,1575 @@ static void label_distance(const size_t height,const size_t width,label_list *bl
 	    dir_sel = Reverse_RB;
 	  }
 	  
-	  local_guard_ne[ReverseNE_NVRNE] = local_label[Reverse_CPR];
+	  local_guard_ne[ReverseNE_NVRNE] = local_label[Reverse_CPR];
+	  
+	  if(local_label[Reverse_RM] != Reverse_NVR && local_label[dir_sel] != local_label[Reverse_RM]) {
+	    local_dist_ne[ReverseNE_NARNE] = local_dist[Reverse_RM]; 	
+	    local_label_ne[ReverseNE_NARNE] = local_label[Reverse_RM];	
+	    local_guard_ne[ReverseNE_NARNE] = local_label[Reverse_CPR];
+	  }
+	  else if(local_label[Reverse_MB] != Reverse_NVR && local_label[dir_sel] != local_label[Reverse_MB]) {
+	    local_dist_ne[ReverseNE_NARNE] = local_dist[Reverse_MB]; 	
+	    local_label_ne[ReverseNE_NARNE] = local_label[Reverse_MB];		
+	    local_guard_ne[ReverseNE_NARNE] = local_label[Reverse_CPR];
+	  }
+	  else if(local_label[Reverse_LB] != Reverse_NVR && local_label[dir_sel] != local_label[Reverse_LB]) {
+	    local_dist_ne[ReverseNE_NARNE] = local_dist[Reverse_LB]; 	
+	    local_label_ne[ReverseNE_NARNE] = local_label[Reverse_LB];	
+	    local_guard_ne[ReverseNE_NARNE] = local_label[Reverse_CPR];
+	  }
+	  else if(local_label[Reverse_RB] != Reverse_NVR && local_label[dir_sel] != local_label[Reverse_RB]) {
+	    local_dist_ne[ReverseNE_NARNE] = local_dist[Reverse_RB]; 	
+	    local_label_ne[ReverseNE_NARNE] = local_label[Reverse_RB];	
+	    local_guard_ne[ReverseNE_NARNE] = local_label[Reverse_CPR];
+	  }
+	}
+	
+	// ocean test
+	blabel min_d_a = INT_MAX;
+	blabel min_d_b = INT_MAX;
+	blabel _ga = 0;
+	blabel _gb = 0;
+	blabel _la = 0;
+	blabel _lb = 0;
+	
+	for(size_t n = ReverseNE_NVRNE; n <= ReverseNE_RBB; n++) {
+	  if(local_label_ne[n] != ReverseNE_NVRNE && local_guard_ne[n] == local_label[Reverse_CPR] && local_dist_ne[n] <= max_distance) {
+	    if(local_dist_ne[n] < min_d_a) {	      
+	      min_d_a = local_dist_ne[n];
+	      _ga = local_guard_ne[n];
+	      _la = local_label_ne[n];
+	    }
+	  }
+	}
+	
+	// min b
+	for(size_t n = ReverseNE_NVRNE; n <= ReverseNE_RBB; n++) {
+	  if(local_label_ne[n] != ReverseNE_NVRNE && local_guard_ne[n] == local_label[Reverse_CPR] && local_dist_ne[n] <= max_distance) {
+	    if(local_dist_ne[n] < min_d_b && local_label_ne[n] != _la) {
+	      min_d_b = local_dist_ne[n];
+	      _gb = local_guard_ne[n];
+	      _lb = local_label_ne[n];
+	    }
+	  }
+	}
+	// check a & b
+	
+	rec_ptr->dist_a = FFMIN(min_d_a,DIST_MAX);
+	rec_ptr->guard_a = _ga;
+	rec_ptr->label_a = _la;
+	rec_ptr->dist_b = FFMIN(min_d_b,DIST_MAX);
+	rec_ptr->guard_b = _gb;
+	rec_ptr->label_b = _lb;
+
+	bl_ptr--;
+	blb_ptr--;
+	rec_ptr--;
+	rec_dn_ptr--;
+      }
+    }
+    
+    bool different = false;
+    
+    for(size_t p = 0; p < img_size; p++) {
+      if(label_change_ptr[p] != distance_ptr[p].label_b) {
+	label_change_ptr[p] = distance_ptr[p].label_b;
+	different = true;
+      }
+    }
+    
+    if(!different)
+      break;
+  }
+}
+
+/**
+ * Area and input colour of every region, and how many pixels have it as
+ * nearest and second nearest foreign label, in a single pass over the
+ * labels, the input symbols and the distance field. Region entries are
+ * updated once per run of one label. With mean set the colour is the mean
+ * of the region's samples, otherwise that of its first pixel, which is
+ * the same for regions of a single colour. The colours go to
+ * block_colour_list, label l at entry l-1.
+ */
+static void region_stats(const bsymbol* symbol,const size_t height,const size_t width,const label_list *block_label,const distance_list *distance_field,size_t max_label,int mean,region_list *region,rgb_colour_list *block_colour_list) {
+  region_stat* stat = region->data_ptr;
+  bsymbol* first = region->first.data_ptr;
+  blabel* area = region->area.data_ptr;
+  blabel* near_a = region->near_a.data_ptr;
+  blabel* near_b = region->near_b.data_ptr;
+  
+  memset(area,0,(max_label+1)*sizeof(blabel));
+  memset(near_a,0,(max_label+1)*sizeof(blabel));
+  memset(near_b,0,(max_label+1)*sizeof(blabel));
+  
+  for(int y = 0; y < height; y++) {
+    const blabel* lbl_ptr = block_label->data_ptr + y*width;
+    const bsymbol* sym_ptr = symbol + y*width;
+    const DebandDistance* near_ptr = distance_field->data_ptr + y*width;
+    int x = 0;
+    
+    while(x < width) {
+      const blabel lbl = lbl_ptr[x];
+      const int x0 = x;
+      
+      if(mean) {
+	region_stat* r = &stat[lbl];
+	int64_t sum[3] = { 0 };
+	
+	do {
+	  const bsymbol sym = sym_ptr[x];
+	  
+	  sum[0] += sym & 0xffff;
+	  sum[1] += sym >> 16 & 0xffff;
+	  sum[2] += sym >> 32 & 0xffff;
+	  x++;
+	} while(x < width && lbl_ptr[x] == lbl);
+	
+	if(!area[lbl]) {
+	  r->sum[0] = sum[0];
+	  r->sum[1] = sum[1];
+	  r->sum[2] = sum[2];
+	}
+	else {
+	  r->sum[0] += sum[0];
+	  r->sum[1] += sum[1];
+	  r->sum[2] += sum[2];
+	}
+      }
+      else {
+	do {
+	  x++;
+	} while(x < width && lbl_ptr[x] == lbl);
+      }
+      
+      if(!area[lbl])
+	first[lbl] = sym_ptr[x0];
+      
+      area[lbl] += x - x0;
+    }
+    
+    for(x = 0; x < width; x++) {
+      near_a[near_ptr[x].label_a]++;
+      near_b[near_ptr[x].label_b]++;
+    }
+  }
+  
+  for(size_t b = 1; b <= max_label; b++) {
+    const region_stat* r = &stat[b];
+    RGB_colour* colour = &block_colour_list->data_ptr[b-1];
+    const int64_t n = area[b];
+    
+    colour->r = first[b] & 0xffff;
+    colour->g = first[b] >> 16 & 0xffff;
+    colour->b = first[b] >> 32 & 0xffff;
+    colour->set = 1;
+    
+    // the division is only needed for regions of several colours
+    if(mean && (r->sum[0] != n*colour->r || r->sum[1] != n*colour->g || r->sum[2] != n*colour->b)) {
+      colour->r = (r->sum[0] + n/2) / n;
+      colour->g = (r->sum[1] + n/2) / n;
+      colour->b = (r->sum[2] + n/2) / n;
+    }
+  }
+}
+
+/**
+ * Count, for every row and tile column, the pixels repeating the colour of
+ * their left neighbour within tolerance. Bands are long runs of one
+ * colour; texture and noise rarely repeat a pixel.
+ */
+static void tile_runs(const bsymbol* symbol,const size_t width,size_t slice_start,size_t slice_end,int tolerance,uint8_t* run_count,size_t tile_cols) {
+  for(size_t y = slice_start; y < slice_end; y++) {
+    const bsymbol* sym_row = symbol + y*width;
+    uint8_t* run_ptr = run_count + y*tile_cols;
+    
+    for(size_t x0 = 0; x0 < width; x0 += TILE_SIZE) {
+      const size_t x1 = FFMIN(x0 + TILE_SIZE, width);
+      int runs = 0;
+      
+      if(tolerance) {
+	for(size_t x = x0+1; x < x1; x++)
+	  runs += symbol_within(sym_row[x],sym_row[x-1],tolerance);
+      }
+      else {
+	for(size_t x = x0+1; x < x1; x++)
+	  runs += sym_row[x] == sym_row[x-1];
+      }
+      
+      *run_ptr++ = runs;
+    }
+  }
+}
+
+/**
+ * Flag the tiles with enough repeated pixels to contain banding and
+ * return how many there are.
+ */
+static size_t tile_classify(const uint8_t* run_count,const size_t height,const size_t width,uint8_t* tile_flat) {
+  const size_t tile_cols = (width + TILE_SIZE-1) / TILE_SIZE;
+  size_t flat_count = 0;
+  
+  for(size_t y0 = 0; y0 < height; y0 += TILE_SIZE) {
+    const size_t y1 = FFMIN(y0 + TILE_SIZE, height);
+    
+    for(size_t t = 0; t < tile_cols; t++) {
+      const size_t tile_width = FFMIN(TILE_SIZE, width - t*TILE_SIZE);
+      int runs = 0;
+      
+      for(size_t y = y0; y < y1; y++)
+	runs += run_count[y*tile_cols + t];
+      
+      *tile_flat = runs * FLAT_TILE_RATIO >= (int)(tile_width*(y1-y0));
+      flat_count += *tile_flat++;
+    }
+  }
+  
+  return flat_count;
+}
+
+/**
+ * Flag, for every row and tile column, whether the row segment differs
+ * from the previous frame.
+ */
+static void tile_diff(const bsymbol* symbol,const bsymbol* prev,const size_t width,size_t slice_start,size_t slice_end,uint8_t* row_diff,size_t tile_cols) {
+  for(size_t y = slice_start; y < slice_end; y++) {
+    uint8_t* diff_ptr = row_diff + y*tile_cols;
+    
+    for(size_t x0 = 0; x0 < width; x0 += TILE_SIZE) {
+      const size_t x1 = FFMIN(x0 + TILE_SIZE, width);
+      const size_t offset = y*width + x0;
+      
+      *diff_ptr++ = !!memcmp(symbol + offset,prev + offset,(x1-x0)*sizeof(bsymbol));
+    }
+  }
+}
+
+/**
+ * Collect the row flags of tile_diff() into changed tiles and grow them by
+ * radius tiles, the reach of a change through the distance field and the
+ * exponent filter. Returns the number of tiles changed before growing.
+ */
+static size_t tile_changes(const uint8_t* row_diff,const size_t height,const size_t width,int radius,uint8_t* tile_changed) {
+  const size_t tile_cols = (width + TILE_SIZE-1) / TILE_SIZE;
+  const size_t tile_rows = (height + TILE_SIZE-1) / TILE_SIZE;
+  size_t changed = 0;
+  
+  // bit 0: changed, bit 1: grown along the row, bit 2: grown along the column
+  for(size_t y = 0; y < height; y++) {
+    uint8_t* tile_ptr = tile_changed + y / TILE_SIZE * tile_cols;
+    
+    if(y % TILE_SIZE == 0)
+      memset(tile_ptr,0,tile_cols);
+    
+    for(size_t t = 0; t < tile_cols; t++)
+      tile_ptr[t] |= row_diff[y*tile_cols + t];
+  }
+  
+  for(size_t ty = 0; ty < tile_rows; ty++) {
+    uint8_t* tile_ptr = tile_changed + ty*tile_cols;
+    
+    for(int t = 0; t < (int)tile_cols; t++) {
+      if(!(tile_ptr[t] & 1))
+	continue;
+      
+      changed++;
+      for(int n = FFMAX(t - radius, 0); n <= FFMIN(t + radius, (int)tile_cols-1); n++)
+	tile_ptr[n] |= 2;
+    }
+  }
+  
+  for(int ty = 0; ty < (int)tile_rows; ty++) {
+    for(size_t t = 0; t < tile_cols; t++) {
+      if(!(tile_changed[ty*tile_cols + t] & 2))
+	continue;
+      
+      for(int n = FFMAX(ty - radius, 0); n <= FFMIN(ty + radius, (int)tile_rows-1); n++)
+	tile_changed[n*tile_cols + t] |= 4;
+    }
+  }
+  
+  for(size_t t = 0; t < tile_rows*tile_cols; t++)
+    tile_changed[t] = tile_changed[t] >> 2;
+  
+  return changed;
+}
+
+/**
+ * Build the normalised 1-D triangular kernel 1,2,..,m,..,2,1 of
+ * kernel_size = 2m-1 taps. The exponent filter applies it along rows and
+ * columns; along rows it is evaluated as two running box sums of width m.
+ */
+static void set_kernel_size(size_t kernel_size, filter_kernel* exponent_kernel) {
+  if(kernel_size < 3) {
+    kernel_size = 3;
+  }
+  
+  if(kernel_size%2 == 0)
+    kernel_size++;
+  
+  allocate_kernel(exponent_kernel,kernel_size);
+  
+  if(!exponent_kernel->kernel.data_ptr)
+    return;
+  
+  size_t mid_point = (kernel_size+1)/2;
+  int v = 1;
+  bool slope_up = true;
+  
+  for(size_t k = 0; k < kernel_size; k++) {
+    exponent_kernel->kernel.data_ptr[k] = v;
+    
+    if(v == mid_point) {
+      slope_up = false;
+    }
+    
+    if(slope_up) {
+      v++;
+    }
+    else {
+      v--;
+    }
+  }
+  
+  // the taps sum to mid_point^2
+  for(size_t k = 0; k < kernel_size; k++) {
+    exponent_kernel->kernel.data_ptr[k] /= (p_float)(mid_point*mid_point);
+  }
+  
+  exponent_kernel->box_size = mid_point;
+}
+
+/**
+ * Horizontal pass of the exponent filter over rows [slice_start, slice_end)
+ * of exp_ptr into out_ptr, clamping at the frame borders. The triangular
+ * kernel is the convolution of two boxes of width m, so each output costs
+ * two running sum updates whatever the kernel size.
+ */
+static void filter_exponent_rows(const size_t height,const size_t width,size_t slice_start,size_t slice_end,const p_float* exp_ptr,p_float* out_ptr, filter_kernel* exponent_kernel) {
+  const int box_size = exponent_kernel->box_size;
+  const int width_end = width - 1;
+  const double norm = 1.0 / ((double)box_size*box_size);
+  double box[MAX_BOX_SIZE];
+  
+  for(size_t y = slice_start; y < slice_end; y++) {
+    const p_float* e_ptr = exp_ptr + y*width;
+    p_float* o_ptr = out_ptr + y*width;
+    double box_sum = 0.0;
+    double tent_sum = 0.0;
+    int b = 0;
+    
+    // box over [x-m+1, x] of the clamped row, started at x = -(m-1)
+    for(int k = -box_size+1; k <= 0; k++) {
+      box_sum += e_ptr[av_clip(k,0,width_end)];
+    }
+    
+    for(int x = -box_size+1; x < (int)width; x++) {
+      if(x > -box_size+1) {
+	box_sum += e_ptr[FFMIN(x + box_size - 1,width_end)];
+	box_sum -= e_ptr[av_clip(x - 1,0,width_end)];
+      }
+      
+      // second box over the last m box sums
+      if(x >= 1)
+	tent_sum -= box[b];
+      
+      box[b] = box_sum;
+      tent_sum += box_sum;
+      b = b + 1 < box_size ? b + 1 : 0;
+      
+      if(x >= 0)
+	o_ptr[x] = tent_sum * norm;
+    }
+  }
+}
+
+/**
+ * Vertical pass of the exponent filter over rows [slice_start, slice_end)
+ * of in_ptr into out_ptr, clamping at the frame borders. Whole rows are
+ * accumulated per kernel tap.
+ */
+static void filter_exponent_columns(const size_t height,const size_t width,size_t slice_start,size_t slice_end,const p_float* in_ptr,p_float* out_ptr, filter_kernel* exponent_kernel) {
+  const int radius = exponent_kernel->size/2;
+  const int height_end = height - 1;
+  const p_float* ek_ptr = exponent_kernel->kernel.data_ptr;
+  
+  for(size_t y = slice_start; y < slice_end; y++) {
+    p_float* o_ptr = out_ptr + y*width;
+    
+    for(int k = 0; k < exponent_kernel->size; k++) {
+      const p_float wght = ek_ptr[k];
+      const p_float* i_ptr = in_ptr + av_clip((int)y + k - radius,0,height_end)*width;
+      
+      if(k == 0) {
+	for(size_t x = 0; x < width; x++)
+	  o_ptr[x] = i_ptr[x]*wght;
+      }
+      else {
+	for(size_t x = 0; x < width; x++)
+	  o_ptr[x] += i_ptr[x]*wght;
+      }
+    }
+  }
+}
+
+/**
+ * Tabulate the blend weight 0.5 / (d / spatial_dist_scale)^e for chamfer
+ * distances d up to max_distance and WEIGHT_TABLE_STEPS+1 exponents evenly
+ * spread over [0,0.5], the range of the filtered exponents.
+ */
+static void set_weight_table(size_t max_distance, float_list* weight_table) {
+  const size_t row_size = WEIGHT_TABLE_STEPS + 1;
+  
+  allocate_float(weight_table,(max_distance+1)*row_size);
+  
+  if(!weight_table->data_ptr)
+    return;
+  
+  for(size_t d = 0; d <= max_distance; d++) {
+    p_float* row_ptr = weight_table->data_ptr + d*row_size;
+    
+    for(size_t e = 0; e < row_size; e++) {
+      // no pixel is at distance 0 from a foreign label; keep the row finite
+      if(d == 0)
+	row_ptr[e] = 1.0f;
+      else
+	row_ptr[e] = 0.5 / pow(d / spatial_dist_scale, 0.5 * e / WEIGHT_TABLE_STEPS);
+    }
+  }
+}
+
+/**
+ * Blend weight for a chamfer distance in the table and an exponent in
+ * [0,0.5], interpolated linearly between exponent steps.
+ */
+static inline p_float table_weight(const p_float* weight_table, int distance, p_float exponent) {
+  const p_float* row_ptr = weight_table + distance*(WEIGHT_TABLE_STEPS + 1);
+  p_float step = exponent * (2 * WEIGHT_TABLE_STEPS);
+  int e = av_clip((int)step,0,WEIGHT_TABLE_STEPS - 1);
+  p_float frac = step - e;
+  
+  return row_ptr[e] + frac*(row_ptr[e+1] - row_ptr[e]);
+}
+
+#ifdef TEST
+
+#undef printf
+
+/**
+ * Pack rows [slice_start, slice_end) of a packed 16-bit image into symbols.
+ */
+static void pack_slice(const pixel* rgb_ptr,const size_t width,size_t slice_start,size_t slice_end,bsymbol* symbol) {
+  const pixel* pel = rgb_ptr + 3*slice_start*width;
+  bsymbol* sym_ptr = symbol + slice_start*width;
+  bsymbol* sym_end = symbol + slice_end*width;
+  
+  for(; sym_ptr < sym_end; sym_ptr++) {
+    *sym_ptr = pack_symbol(pel);
+    pel += 3;
+  }
+}
+
+/**
+ * Two pass connected component labelling of exact colour regions
+ * (8-connectivity) in slice_count slices, as the filter runs it.
+ */
+static void label_slices(pixel* rgb_ptr,const size_t height,const size_t width,int tolerance,size_t slice_count,label_list *block_label,size_t *_max_label) {
+  label_table table;
+  
+  allocate_label_table(&table,width,height,slice_count);
+  
+  if(tolerance) {
+    symbol_list raw;
+    
+    allocate_symbol(&raw,height*width);
+    pack_slice(rgb_ptr,width,0,height,raw.data_ptr);
+    tolerant_slice(raw.data_ptr,height,width,0,height,tolerance,table.symbol.data_ptr);
+    free_symbol(&raw);
+  }
+  else
+    pack_slice(rgb_ptr,width,0,height,table.symbol.data_ptr);
+  
+  for(size_t i = 0; i < slice_count; i++)
+    label_slice(width,height*i/slice_count,height*(i+1)/slice_count,i,&table,block_label,ff_deband_run_length_c);
+  label_merge(height,width,&table,block_label,_max_label);
+  for(size_t i = 0; i < slice_count; i++)
+    label_resolve(width,height*i/slice_count,height*(i+1)/slice_count,&table,block_label);
+  
+  free_label_table(&table);
+}
+
+static void label(pixel* rgb_ptr,const size_t height,const size_t width,int tolerance,label_list *block_label,size_t *_max_label) {
+  label_slices(rgb_ptr,height,width,tolerance,1,block_label,_max_label);
+}
+
+/* Previous labeller: forward/backward neighbourhood sweeps. */
+static void label_forward(const label_list *block_init_label, const size_t blocks_per_row,const size_t blocks_per_column,label_list *block_label) {
+  const size_t block_count = block_init_label->size;
+  
+  if(block_label->size != block_count) {    
+    allocate_label(block_label,block_count);
+  }
+  
+  blabel label = 1;
+  blabel* row_symbol_ptr = (blabel*)block_init_label->data_ptr;  
+  blabel* block_label_ptr = (blabel*)block_label->data_ptr;
+  
+  block_label->data_ptr[0] = label;
+  label++;
+  
+  blabel* symbol = row_symbol_ptr+1;
+  
+  // top row
+  for(size_t x = 1; x < blocks_per_row; x++) {
+    
+    blabel lbl = block_label->data_ptr[x-1];
+    
+    if(*symbol == *(symbol-1) && lbl != 0) {
+      block_label->data_ptr[x] = lbl;
+    }
+    else {				
+      block_label->data_ptr[x] = label;
+      label++;
+    }
+    
+    
+    symbol++;    
+  }
+  
+  blabel* symbol_prev = row_symbol_ptr;
+  symbol = row_symbol_ptr + blocks_per_row;
+  
+  // left column
+  for(size_t y = 1; y < blocks_per_column; y++) {
+    size_t index = y*blocks_per_row;
+    
+    
+    blabel lbl = block_label->data_ptr[index-blocks_per_row];
+    
+    if(*symbol == *(symbol_prev) && lbl != 0) {
+      block_label->data_ptr[index] = lbl;
+    }
+    else {				
+      block_label->data_ptr[index] = label;
+      label++;
+    }
+    
+    symbol_prev = symbol;
+    symbol += blocks_per_row;		
+  }
+  
+  blabel* label_ptr = block_label_ptr;
+  size_t blocks_per_row_lr = blocks_per_row-1;
+  
+  // body
+  
+  for(size_t y = 1; y < blocks_per_column; y++) {
+    symbol = row_symbol_ptr + y*blocks_per_row + 1;    
+    label_ptr = block_label_ptr + y*blocks_per_row + 1;
+    
+    for(size_t x = 1; x < blocks_per_row; x++) {
+      
+      // left
+      blabel lbl = *(label_ptr - 1);
+      bool assigned = false;
+      bool increment = false;
+      
+      if(*symbol == *(symbol-1) && lbl != 0) {
+	*label_ptr = lbl;
+	assigned = true;
+      }
+      else {		
+	assigned = true;
+	increment = true;
+	*label_ptr = label;	
+      }
+      
+      // top
+      lbl = *(label_ptr-blocks_per_row);
+      
+      if(*symbol == *(symbol-blocks_per_row) && lbl != 0) {
+	if(*label_ptr == 0) {
+	  *label_ptr = lbl;
+	  assigned = true;
+	}
+	else if(lbl < *label_ptr) {
+	  *label_ptr = lbl;
+	  assigned = true;
+	}
+	
+	increment = false;
+      }
+      else if(!assigned){		
+	assigned = true;
+	increment = true;
+	*label_ptr = label;	
+      }
+      
+      // top left
+      lbl = *(label_ptr-blocks_per_row-1);
+      
+      if(*symbol == *(symbol-blocks_per_row-1) && lbl != 0) {
+	if(*label_ptr == 0) {
+	  *label_ptr = lbl;
+	  assigned = true;
+	}
+	else if(lbl < *label_ptr) {
+	  *label_ptr = lbl;
+	  assigned = true;
+	}
+	
+	increment = false;
+      }
+      else if(!assigned){	
+	increment = true;
+	*label_ptr = label;	
+      }
+      
+      if(x < blocks_per_row_lr) {
+	// top right
+	lbl = *(label_ptr-blocks_per_row+1);
+	
+	if(*symbol == *(symbol-blocks_per_row+1) && lbl != 0) {
+	  if(*label_ptr == 0) {
+	    *label_ptr = lbl;
+	    assigned = true;
+	  }
+	  else if(lbl < *label_ptr) {
+	    *label_ptr = lbl;
+	    assigned = true;
+	  }
+	  
+	  increment = false;
+	}
+	else if(!assigned){	
+	  increment = true;
+	  *label_ptr = label;	  
+	}
+      }
+      
+      
+      if(increment) {
+	label++;
+      }
+      
+      
+      symbol++;      
+      label_ptr++;
+    }	
+  }
+}
+
+static void label_backward(const label_list *block_init_label, const size_t blocks_per_row,const size_t blocks_per_column,label_list *block_label) {
+  const size_t block_count = block_label->size;
+  
+  blabel* block_label_ptr = (blabel*)block_label->data_ptr;
+  blabel* row_symbol_ptr = (blabel*)block_init_label->data_ptr;
+  
+  int offset = blocks_per_row*(blocks_per_column-2) + blocks_per_row - 1;
+  
+  blabel* label_ptr = block_label_ptr + offset;
+  blabel* symbol = row_symbol_ptr + offset;
+  
+  // right column
+  for(int y = blocks_per_column-2; y >= 0; y--) {
+    
+    blabel lbl = *(label_ptr + blocks_per_row);
+    
+    if(*symbol == *(symbol+blocks_per_row) && lbl != 0) {
+      if(lbl < *label_ptr) {
+	*label_ptr = lbl;
+      }
+    }
+    
+    lbl = *(label_ptr + blocks_per_row - 1);
+    
+    if(*symbol == *(symbol+blocks_per_row-1) && lbl != 0) {
+      if(lbl < *label_ptr) {
+	*label_ptr = lbl;
+      }
+    }
+    
+    label_ptr -= blocks_per_row;
+    symbol -= blocks_per_row;		
+  }
+  
+  // bottom row
+  offset = blocks_per_row*(blocks_per_column-1) + blocks_per_row - 2;
+  label_ptr = block_label_ptr + offset;
+  symbol = row_symbol_ptr + offset;
+   
+  for(int x = blocks_per_row-2; x >= 0; x--) {
+    
+    blabel lbl = *(label_ptr + 1);
+    
+    if(*symbol == *(symbol+1) && lbl != 0) {
+      if(lbl < *label_ptr)
+	*label_ptr = lbl;
+    }
+    
+    
+    label_ptr--;
+    symbol--;    
+  }
+  
+  // body
+  for(int y = blocks_per_column-2; y >= 0; y--) {
+    offset = blocks_per_row*y + blocks_per_row - 2;
+    symbol = row_symbol_ptr + offset;    
+    label_ptr = block_label_ptr + offset;
+    
+    for(int x = blocks_per_row-2; x >= 0; x--) {
+      // right
+      int lbl = *(label_ptr + 1);
+      
+      if(*symbol == *(symbol+1) && lbl != 0) {
+	if(lbl < *label_ptr)
+	  *label_ptr = lbl;
+      }
+      // below
+      lbl = *(label_ptr + blocks_per_row);
+      
+      if(*symbol == *(symbol+blocks_per_row) && lbl != 0) {
+	if(lbl < *label_ptr)
+	  *label_ptr = lbl;
+      }
+      // below right
+      lbl = *(label_ptr + blocks_per_row + 1);
+      
+      if(*symbol == *(symbol+blocks_per_row+1) && lbl != 0) {
+	if(lbl < *label_ptr)
+	  *label_ptr = lbl;
+      }
+      
+      if(x > 0) {
+	// below left
+	lbl = *(label_ptr + blocks_per_row - 1);
+	
+	if(*symbol == *(symbol+blocks_per_row-1) && lbl != 0) {
+	  if(lbl < *label_ptr)
+	    *label_ptr = lbl;
+	}
+      }
+      
+      symbol--;      
+      label_ptr--;
+    }
+  }
+}
+
+static void label_sweep(pixel* rgb_ptr,const size_t height,const size_t width,label_list *block_label,size_t *_max_label) {
+  label_list init_label;
+  size_t stride = width*3;
+  allocate_label(&init_label,height*width);
+ 
+  label_list _block_label;
+  allocate_label(&_block_label,init_label.size);
+  
+  label_list _block_label_prev;
+  allocate_label(&_block_label_prev,init_label.size);
+  
+  pixel* row_ptr = 0;
+  
+  blabel* lbl_ptr = init_label.data_ptr;
+  blabel* row_lbl_ptr = 0;
+  
+  for(size_t y = 0; y < height; y++) {
+    row_ptr = rgb_ptr + y*stride;
+    row_lbl_ptr = lbl_ptr + y*width;
+    
+    for(size_t x = 0; x < width; x++) {
+      *row_lbl_ptr = *row_ptr + 256*(*(row_ptr+1)) + 65536*(*(row_ptr+2));      
+      row_lbl_ptr++;
+      row_ptr += 3;
+    }    
+  }
+  
+  size_t block_label_size = _block_label.size;
+  
+  while(1) {
+    
+    label_forward(&init_label,width,height,&_block_label);    
+    label_backward(&init_label,width,height,&_block_label);
+   
+    short different = 0;
+    
+    for(size_t p = 0; p < block_label_size; p++) {
+      if(_block_label_prev.data_ptr[p] != _block_label.data_ptr[p])
+      {
+	different = 1;
+	break;
+      }
+    }
+    
+    if(!different)
+      break;
+    
+    memcpy(_block_label_prev.data_ptr,_block_label.data_ptr,_block_label_prev.size*sizeof(blabel));
+  }
+  
+  blabel min_label = INT_MAX;
+  blabel max_label = 0;
+  
+  blabel lbl = 0;
+  
+   
+  for(size_t blk = 0; blk < block_label_size; blk++) {
+    lbl = _block_label.data_ptr[blk];
+    
+    if(lbl > max_label)
+      max_label = lbl;
+    
+    if(lbl < min_label)
+      min_label = lbl;
+  }  
+    
+  size_t label_count = max_label - min_label + 2;
+  
+  label_list label_mapping;
+  allocate_label(&label_mapping,label_count);
+  
+  blabel current_label = 1;
+  
+  for(size_t blk = 0; blk < block_label_size; blk++) {
+    lbl = _block_label.data_ptr[blk];
+    
+    if(label_mapping.data_ptr[lbl] == 0) {
+      label_mapping.data_ptr[lbl] = current_label;
+      current_label++;
+    }
+  }
+  
+  for(size_t blk = 0; blk < block_label_size; blk++) {
+    lbl = _block_label.data_ptr[blk];
+    
+    block_label->data_ptr[blk] = label_mapping.data_ptr[lbl];
+  }
+  
+  *_max_label = current_label-1;
+    
+  free_label(&init_label);  
+  free_label(&_block_label);  
+  free_label(&_block_label_prev);
+  free_label(&label_mapping);
+}
+/**
+ * Exact reference: propagate the minimum label between equal colour
+ * 8-neighbours until no label changes, then number regions in raster order.
+ */
+static void label_fixpoint(pixel* rgb_ptr,const size_t height,const size_t width,label_list *block_label,size_t *_max_label) {
+  static const int dx[4] = { -1, -1, 0, 1 };
+  static const int dy[4] = { 0, -1, -1, -1 };
+  const size_t size = height*width;
+  blabel* lbl = block_label->data_ptr;
+  label_list label_mapping;
+  bool changed = true;
+  
+  for(size_t p = 0; p < size; p++)
+    lbl[p] = p+1;
+  
+  while(changed) {
+    changed = false;
+    
+    for(int pass = 0; pass < 2; pass++) {
+      for(size_t i = 0; i < size; i++) {
+	// forward scan looks up and left, reverse scan down and right
+	size_t p = pass ? size-1-i : i;
+	int x = p%width;
+	int y = p/width;
+	
+	for(int n = 0; n < 4; n++) {
+	  int nx = pass ? x - dx[n] : x + dx[n];
+	  int ny = pass ? y - dy[n] : y + dy[n];
+	  size_t q = ny*width + nx;
+	  
+	  if(nx < 0 || ny < 0 || nx >= width || ny >= height)
+	    continue;
 	  
-	  if(local_label[Reverse_RM] != Reverse_NVR && local_label[dir_sel] != local_label[Reverse_RM]) {
-	    local_dist_ne[ReverseNE_NARNE] = local_dist[Reverse_RM]; 	
-	    local_label_ne[ReverseNE_NARNE] = local_label[Reverse_RM];	
-	    local_guard_ne[ReverseNE_NARNE] = local_label[Reverse_CPR];
-	  }
-	  else if(local_label[Reverse_MB] != Reverse_NVR && local_label[dir_sel] != local_label[Reverse_MB]) {
-	    local_dist_ne[ReverseNE_NARNE] = local_dist[Reverse_MB]; 	
-	    local_label_ne[ReverseNE_NARNE] = local_label[Reverse_MB];		
-	    local_guard_ne[ReverseNE_NARNE] = local_label[Reverse_CPR];
-	  }
-	  else if(local_label[Reverse_LB] != Reverse_NVR && local_label[dir_sel] != local_label[Reverse_LB]) {
-	    local_dist_ne[ReverseNE_NARNE] = local_dist[Reverse_LB]; 	
-	    local_label_ne[ReverseNE_NARNE] = local_label[Reverse_LB];	
-	    local_guard_ne[ReverseNE_NARNE] = local_label[Reverse_CPR];
-	  }
-	  else if(local_label[Reverse_RB] != Reverse_NVR && local_label[dir_sel] != local_label[Reverse_RB]) {
-	    local_dist_ne[ReverseNE_NARNE] = local_dist[Reverse_RB]; 	
-	    local_label_ne[ReverseNE_NARNE] = local_label[Reverse_RB];	
-	    local_guard_ne[ReverseNE_NARNE] = local_label[Reverse_CPR];
-	  }
-	}
-	
-	// ocean test
-	blabel min_d_a = INT_MAX;
-	blabel min_d_b = INT_MAX;
-	blabel _ga = 0;
-	blabel _gb = 0;
-	blabel _la = 0;
-	blabel _lb = 0;
-	
-	for(size_t n = ReverseNE_NVRNE; n <= ReverseNE_RBB; n++) {
-	  if(local_label_ne[n] != ReverseNE_NVRNE && local_guard_ne[n] == local_label[Reverse_CPR]) {
-	    if(local_dist_ne[n] < min_d_a) {	      
-	      min_d_a = local_dist_ne[n];
-	      _ga = local_guard_ne[n];
-	      _la = local_label_ne[n];
-	    }
-	  }
-	}
-	
-	// min b
-	for(size_t n = ReverseNE_NVRNE; n <= ReverseNE_RBB; n++) {
-	  if(local_label_ne[n] != ReverseNE_NVRNE && local_guard_ne[n] == local_label[Reverse_CPR]) {
-	    if(local_dist_ne[n] < min_d_b && local_label_ne[n] != _la) {
-	      min_d_b = local_dist_ne[n];
-	      _gb = local_guard_ne[n];
-	      _lb = local_label_ne[n];
-	    }
+	  if(!memcmp(rgb_ptr + 3*p,rgb_ptr + 3*q,3*sizeof(pixel)) && lbl[q] < lbl[p]) {
+	    lbl[p] = lbl[q];
+	    changed = true;
 	  }
 	}
-	// check a & b
-	
-	*ma_ptr = min_d_a;
-	*ga_ptr = _ga;
-	*la_ptr = _la;
-	*mb_ptr = min_d_b;
-	*gb_ptr = _gb;
-	*lb_ptr = _lb;
-
-	bl_ptr--;
-	blb_ptr--;
-	ma_ptr--;
-	mab_ptr--;
-	la_ptr--;
-	lab_ptr--;
-	ga_ptr--;
-	gab_ptr--;
-	mb_ptr--;
-	mbb_ptr--;
-	lb_ptr--;
-	lbb_ptr--;
-	gb_ptr--;
-	gbb_ptr--;
       }
     }
+  }
+  
+  allocate_label(&label_mapping,size+1);
+  *_max_label = 0;
+  
+  for(size_t p = 0; p < size; p++) {
+    if(!label_mapping.data_ptr[lbl[p]])
+      label_mapping.data_ptr[lbl[p]] = ++(*_max_label);
     
-    bool different = false;
+    lbl[p] = label_mapping.data_ptr[lbl[p]];
+  }
+  
+  free_label(&label_mapping);
+}
+
+/**
+ * Check that every region of the previous labeller lies within a single
+ * region of the new one, i.e. the new labels only merge fragments.
+ */
+static int label_refines(const label_list *fine,size_t fine_max_label,const label_list *coarse) {
+  label_list mapping;
+  int ret = 1;
+  
+  allocate_label(&mapping,fine_max_label+1);
+  
+  for(size_t p = 0; p < fine->size; p++) {
+    blabel* m = &mapping.data_ptr[fine->data_ptr[p]];
     
-    for(size_t p = 0; p < img_size; p++) {
-      if(label_change.data_ptr[p] != label_b_ptr[p]) {
-	different = true;
-	break;
+    if(*m == 0)
+      *m = coarse->data_ptr[p];
+    else if(*m != coarse->data_ptr[p])
+      ret = 0;
+  }
+  
+  free_label(&mapping);
+  return ret;
+}
+
+#include "libavutil/lfg.h"
+
+/**
+ * Direct 2-D evaluation of the exponent filter: k*k clamped taps of the
+ * outer product of the 1-D kernel.
+ */
+static void filter_exponent_reference(const size_t height,const size_t width,const p_float* exp_ptr,p_float* out_ptr, filter_kernel* exponent_kernel) {
+  const int radius = exponent_kernel->size/2;
+  const p_float* ek_ptr = exponent_kernel->kernel.data_ptr;
+  
+  for(int y = 0; y < height; y++) {
+    for(int x = 0; x < width; x++) {
+      double sum = 0.0;
+      
+      for(int ky = -radius; ky <= radius; ky++) {
+	for(int kx = -radius; kx <= radius; kx++) {
+	  int yr = av_clip(y + ky,0,height-1);
+	  int xr = av_clip(x + kx,0,width-1);
+	  
+	  sum += ek_ptr[ky+radius]*ek_ptr[kx+radius]*exp_ptr[yr*width + xr];
+	}
       }
+      
+      out_ptr[y*width + x] = sum;
     }
-    
-    if(!different)
-      break;
-    
-    memcpy(label_change.data_ptr,label_b_ptr,img_size*sizeof(blabel));
   }
+}
+
+static int test_filter_exponent(const size_t height,const size_t width,size_t kernel_size,AVLFG *lfg) {
+  filter_kernel exponent_kernel;
+  float_list exponent;
+  float_list filtered;
+  float_list result;
+  float_list reference;
+  p_float max_error = 0.0f;
   
-  // free allocations
-  free_label(&guard_a);
-  free_label(&guard_b);
-  free_label(&label_change);
+  set_kernel_size(kernel_size,&exponent_kernel);
+  allocate_float(&exponent,height*width);
+  allocate_float(&filtered,height*width);
+  allocate_float(&result,height*width);
+  allocate_float(&reference,height*width);
+  
+  for(size_t p = 0; p < exponent.size; p++)
+    exponent.data_ptr[p] = 0.5f * av_lfg_get(lfg) / UINT_MAX;
+  
+  filter_exponent_rows(height,width,0,height,exponent.data_ptr,filtered.data_ptr,&exponent_kernel);
+  filter_exponent_columns(height,width,0,height,filtered.data_ptr,result.data_ptr,&exponent_kernel);
+  filter_exponent_reference(height,width,exponent.data_ptr,reference.data_ptr,&exponent_kernel);
+  
+  for(size_t p = 0; p < result.size; p++)
+    max_error = FFMAX(max_error,fabs(result.data_ptr[p] - reference.data_ptr[p]));
+  
+  free_kernel(&exponent_kernel);
+  free_float(&exponent);
+  free_float(&filtered);
+  free_float(&result);
+  free_float(&reference);
+  
+  return max_error < 1e-6f;
+}
+
+static int test_weight_table(AVLFG *lfg) {
+  const size_t max_distance = 200;
+  float_list weight_table;
+  double max_error = 0.0;
+  
+  set_weight_table(max_distance,&weight_table);
+  
+  for(size_t d = 1; d <= max_distance; d++) {
+    for(int i = 0; i < 64; i++) {
+      p_float exponent = 0.5f * av_lfg_get(lfg) / UINT_MAX;
+      double reference = 0.5 / pow(d / spatial_dist_scale,exponent);
+      double weight = table_weight(weight_table.data_ptr,d,exponent);
+      
+      max_error = FFMAX(max_error,fabs(weight - reference) / reference);
+    }
+  }
+  
+  free_float(&weight_table);
+  
+  return max_error < 1e-4;
 }
 
-static void label_stat(pixel* rgb_ptr,const size_t height,const size_t width,label_list *block_label,size_t _max_label,rgb_colour_list* block_colour_list) {
-  RGB_colour* block_colour = block_colour_list->data_ptr;
+/* The DSP blend selected for this CPU must match the C version exactly. */
+static int test_blend(AVLFG *lfg) {
+  enum { LABELS = 64, WIDTH = 1001 };
+  uint16_t colour[4*LABELS];
+  int lbl[WIDTH];
+  DebandDistance nearest[WIDTH];
+  float weight_a[WIDTH], weight_b[WIDTH];
+  float ref[3*WIDTH], out[3*WIDTH];
+  uint16_t fixed[3*WIDTH];
+  DebandDSPContext dsp = { ff_deband_blend_line_c, ff_deband_blend_line_fixed_c, ff_deband_run_length_c };
+  int ok;
   
-  for(size_t b = 0; b < _max_label; b++) {
-    block_colour[b].set = 0;
+  if (ARCH_X86)
+    ff_deband_init_x86(&dsp);
+  
+  for(int i = 0; i < 4*LABELS; i++)
+    colour[i] = av_lfg_get(lfg);
+  
+  for(int x = 0; x < WIDTH; x++) {
+    lbl[x] = 1 + av_lfg_get(lfg)%LABELS;
+    nearest[x].label_a = av_lfg_get(lfg)%(LABELS+1);
+    nearest[x].label_b = av_lfg_get(lfg)%(LABELS+1);
+    weight_a[x] = (x%5) ? (float)av_lfg_get(lfg) / UINT_MAX : 0.0f;
+    weight_b[x] = (x%3) ? (float)av_lfg_get(lfg) / UINT_MAX : 0.0f;
   }
   
-  size_t block_label_size = block_colour_list->size;
-  blabel* lbl_ptr = 0;
-  blabel* top_ptr = block_label->data_ptr;
-  pixel* row_ptr = 0;
-  blabel lbl = 0;
-  size_t stride = 3*width;
+  ff_deband_blend_line_c(ref,colour,lbl,nearest,weight_a,weight_b,WIDTH);
+  dsp.blend_line(out,colour,lbl,nearest,weight_a,weight_b,WIDTH);
+  dsp.blend_line_fixed(fixed,colour,lbl,nearest,weight_a,weight_b,WIDTH);
   
-  for(size_t y = 0; y < height; y++) {
-    lbl_ptr = top_ptr + y*width;
-    row_ptr = rgb_ptr + y*stride;
+  ok = !memcmp(ref,out,sizeof(out));
+  
+  // the fixed point blend rounds like the float path up to one step
+  for(int i = 0; i < 3*WIDTH; i++)
+    ok &= FFABS((int)fixed[i] - (int)(ref[i] + 0.5f)) <= 1;
+  
+  return ok;
+}
+
+// runs of every length up to past the vector width, ending on a symbol
+// that differs in either half
+static int test_run_length(AVLFG *lfg) {
+  enum { WIDTH = 40 };
+  bsymbol symbol[WIDTH];
+  DebandDSPContext dsp = { ff_deband_blend_line_c, ff_deband_blend_line_fixed_c, ff_deband_run_length_c };
+  int ok = 1;
+  
+  if (ARCH_X86)
+    ff_deband_init_x86(&dsp);
+  
+  for(int run = 1; run <= WIDTH; run++) {
+    const bsymbol sym = (bsymbol)av_lfg_get(lfg) << 32 | av_lfg_get(lfg);
     
-    for(size_t x = 0; x < width; x++) {
-      lbl = *lbl_ptr - 1;
-      
-      if(block_colour[lbl].set == 0) {
-	block_colour[lbl].r = *row_ptr;
-	block_colour[lbl].g = *(row_ptr+1);
-	block_colour[lbl].b = *(row_ptr+2);
-	block_colour[lbl].set = 1;
-      }      
+    for(int x = 0; x < WIDTH; x++)
+      symbol[x] = x < run ? sym : sym ^ (bsymbol)1 << (x & 1 ? 40 : 8);
+    
+    for(int width = 1; width <= WIDTH; width++)
+      ok &= dsp.run_length(symbol,width) == FFMIN(run,width) &&
+	ff_deband_run_length_c(symbol,width) == FFMIN(run,width);
+  }
+  
+  return ok;
+}
+
+// two regions side by side, the left one with a ramp of red whose mean
+// falls between two samples; without the mean it has its first colour
+static int test_region_stats(void) {
+  enum { WIDTH = 8, HEIGHT = 4 };
+  bsymbol symbol[WIDTH*HEIGHT];
+  blabel lbl[WIDTH*HEIGHT];
+  DebandDistance nearest[WIDTH*HEIGHT] = { { 0 } };
+  label_list block_label = { lbl, WIDTH*HEIGHT };
+  distance_list distance_field = { nearest, WIDTH*HEIGHT };
+  region_list region;
+  rgb_colour_list block_colour_list;
+  const blabel *area, *near_a, *near_b;
+  const RGB_colour* colour;
+  int ok;
+  
+  allocate_region(&region,3);
+  allocate_colour(&block_colour_list,2);
+  area = region.area.data_ptr;
+  near_a = region.near_a.data_ptr;
+  near_b = region.near_b.data_ptr;
+  colour = block_colour_list.data_ptr;
+  
+  for(int y = 0; y < HEIGHT; y++) {
+    for(int x = 0; x < WIDTH; x++) {
+      const int p = y*WIDTH + x;
       
-      lbl_ptr++;
-      row_ptr += 3;
+      lbl[p] = x < 3 ? 1 : 2;
+      symbol[p] = x < 3 ? 10*x + y | (bsymbol)100 << 16 | (bsymbol)7*y << 32 : 500;
+      // the left region sees the right one, the first column on the right
+      // sees the left one
+      nearest[p].label_a = x < 3 ? 2 : x == 3 ? 1 : 0;
     }
   }
+  
+  region_stats(symbol,HEIGHT,WIDTH,&block_label,&distance_field,2,1,&region,&block_colour_list);
+  
+  // red: (4*30 + 3*6 + 6) / 12
+  ok = area[1] == 12 && area[2] == 20 &&
+    colour[0].r == 12 && colour[0].g == 100 && colour[0].b == 11 &&
+    colour[1].r == 500 && colour[1].g == 0 && colour[1].b == 0;
+  ok &= near_a[0] == 16 && near_a[1] == 4 && near_a[2] == 12 &&
+    near_b[0] == 32 && near_b[1] == 0 && near_b[2] == 0;
+  
+  region_stats(symbol,HEIGHT,WIDTH,&block_label,&distance_field,2,0,&region,&block_colour_list);
+  
+  ok &= area[1] == 12 && area[2] == 20 &&
+    colour[0].r == 0 && colour[0].g == 100 && colour[0].b == 0 &&
+    colour[1].r == 500 && colour[1].g == 0 && colour[1].b == 0;
+  
+  free_region(&region);
+  free_colour(&block_colour_list);
+  return ok;
 }
 
-static void label_histogram(blabel* label_ptr, label_list *hist,size_t pixel_count) {	
-  blabel* lbl_ptr = label_ptr;
+// gradients are banding candidates everywhere, noise nowhere; a change
+// grows by the given radius
+static int test_tiles(AVLFG *lfg) {
+  const size_t width = 100;
+  const size_t height = 70;
+  const size_t tile_cols = (width + TILE_SIZE-1) / TILE_SIZE;
+  const size_t tile_count = (height + TILE_SIZE-1) / TILE_SIZE * tile_cols;
+  pixel rgb[100*70*3];
+  bsymbol symbol[100*70];
+  bsymbol prev[100*70];
+  uint8_t run_count[70*4];
+  uint8_t tile_flat[3*4];
+  size_t grown = 0;
+  int ok = 1;
   
-  for(size_t p = 0; p < pixel_count; p++) {
-    hist->data_ptr[*lbl_ptr]++;
-    lbl_ptr++;
+  for(size_t p = 0; p < width*height; p++) {
+    rgb[3*p] = rgb[3*p+1] = rgb[3*p+2] = (p % width) / 8;
   }
+  
+  pack_slice(rgb,width,0,height,symbol);
+  tile_runs(symbol,width,0,height,0,run_count,tile_cols);
+  ok &= tile_classify(run_count,height,width,tile_flat) == tile_count;
+  
+  for(size_t p = 0; p < width*height*3; p++)
+    rgb[p] = av_lfg_get(lfg) & 0xff;
+  
+  pack_slice(rgb,width,0,height,symbol);
+  tile_runs(symbol,width,0,height,0,run_count,tile_cols);
+  ok &= tile_classify(run_count,height,width,tile_flat) == 0;
+  
+  memcpy(prev,symbol,sizeof(symbol));
+  symbol[40*width + 40] ^= 1;
+  
+  tile_diff(symbol,prev,width,0,height,run_count,tile_cols);
+  ok &= tile_changes(run_count,height,width,1,tile_flat) == 1;
+  
+  for(size_t t = 0; t < tile_count; t++)
+    grown += tile_flat[t];
+  ok &= grown == 9;
+  
+  return ok;
 }
 
-static void set_kernel_size(size_t kernel_size, filter_kernel* exponent_kernel_2d) {
-  if(kernel_size < 3) {
-    kernel_size = 3;
+// isolated speckle within tolerance leaves the regions of a gradient as
+// they were, without tolerance every speckle is a region of its own
+static int test_tolerance(void) {
+  const size_t width = 96;
+  const size_t height = 40;
+  pixel rgb[96*40*3];
+  label_list clean_label;
+  label_list block_label;
+  size_t clean_max_label = 0;
+  size_t max_label = 0;
+  size_t speckles = 0;
+  int ok;
+  
+  allocate_label(&clean_label,width*height);
+  allocate_label(&block_label,width*height);
+  
+  for(size_t p = 0; p < width*height; p++)
+    rgb[3*p] = rgb[3*p+1] = rgb[3*p+2] = 100 + (p % width) / 8;
+  
+  label(rgb,height,width,0,&clean_label,&clean_max_label);
+  
+  for(size_t y = 2; y < height-1; y += 5) {
+    for(size_t x = 3; x < width-1; x += 8) {
+      pixel* pel = rgb + 3*(y*width + x);
+      pel[0]++;
+      pel[2]--;
+      speckles++;
+    }
   }
   
-  if(kernel_size%2 == 0)
-    kernel_size++;
+  label(rgb,height,width,0,&block_label,&max_label);
+  ok = max_label == clean_max_label + speckles;
+  
+  label(rgb,height,width,1,&block_label,&max_label);
+  ok &= max_label == clean_max_label &&
+    !memcmp(block_label.data_ptr,clean_label.data_ptr,width*height*sizeof(blabel));
   
-  float_list exponent_kernel;
-  allocate_float(&exponent_kernel,kernel_size);
+  free_label(&clean_label);
+  free_label(&block_label);
+  return ok;
+}
+
+// chamfer distance from every pixel to every foreign label along paths
+// within the pixel's own region, relaxed until nothing changes; entries
+// beyond max_distance are dropped
+static void distance_reference(const blabel* lbl,const size_t height,const size_t width,size_t max_label,int max_distance,int* ref) {
+  const size_t img_size = height*width;
+  bool changed = true;
   
-  allocate_kernel(exponent_kernel_2d,kernel_size*kernel_size);
+  for(size_t p = 0; p < (max_label+1)*img_size; p++)
+    ref[p] = INT_MAX;
   
+  while(changed) {
+    changed = false;
     
-  size_t mid_point = (kernel_size+1)/2;
-  int v = 1;
-  bool slope_up = true;
+    for(size_t y = 0; y < height; y++) {
+      for(size_t x = 0; x < width; x++) {
+	const size_t p = y*width + x;
+	
+	for(int dy = -1; dy <= 1; dy++) {
+	  for(int dx = -1; dx <= 1; dx++) {
+	    const int d = dx && dy ? 7 : 5;
+	    const size_t q = p + dy*(ptrdiff_t)width + dx;
+	    
+	    if((!dx && !dy) || (int)x+dx < 0 || (int)x+dx >= (int)width || (int)y+dy < 0 || (int)y+dy >= (int)height)
+	      continue;
+	    
+	    if(lbl[q] != lbl[p] && d < ref[lbl[q]*img_size + p]) {
+	      ref[lbl[q]*img_size + p] = d;
+	      changed = true;
+	    }
+	    
+	    if(lbl[q] == lbl[p]) {
+	      for(size_t l = 1; l <= max_label; l++) {
+		const int dq = ref[l*img_size + q];
+		
+		if(dq <= max_distance - d && dq + d < ref[l*img_size + p]) {
+		  ref[l*img_size + p] = dq + d;
+		  changed = true;
+		}
+	      }
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
+
+// the nearest two foreign labels have to be at the reference distance,
+// ties between labels may go either way; when the sweeps are cut short
+// every label found still has to be at least as far as the reference
+static int test_label_distance(blabel* lbl,const size_t height,const size_t width,size_t max_label,int max_distance,int max_passes,int exact) {
+  const size_t img_size = height*width;
+  label_list block_label = { lbl, img_size };
+  distance_list distance_field;
+  label_list label_change;
+  int* ref = av_malloc_array((max_label+1)*img_size,sizeof(*ref));
+  int ok = 1;
   
-  for(size_t k = 0; k < kernel_size; k++) {
-    exponent_kernel.data_ptr[k] = v;
+  allocate_distance(&distance_field,img_size);
+  allocate_label(&label_change,img_size);
+  
+  distance_reference(lbl,height,width,max_label,max_distance,ref);
+  label_distance(height,width,&block_label,max_label,max_distance,max_passes,&distance_field,&label_change);
+  
+  for(size_t p = 0; p < img_size; p++) {
+    const DebandDistance* rec = distance_field.data_ptr + p;
+    int first = INT_MAX;
+    int second = INT_MAX;
     
-    if(v == mid_point) {
-      slope_up = false;
+    for(size_t l = 1; l <= max_label; l++) {
+      const int d = ref[l*img_size + p];
+      
+      if(d < first) {
+	second = first;
+	first = d;
+      }
+      else if(d < second)
+	second = d;
     }
     
-    if(slope_up) {
-      v++;
+    if(exact) {
+      ok &= rec->dist_a == FFMIN(first,DIST_MAX) && rec->dist_b == FFMIN(second,DIST_MAX);
+      ok &= rec->label_a ? ref[rec->label_a*img_size + p] == rec->dist_a : first == INT_MAX;
+      ok &= rec->label_b ? rec->label_b != rec->label_a && ref[rec->label_b*img_size + p] == rec->dist_b : second == INT_MAX;
     }
     else {
-      v--;
+      ok &= rec->dist_a >= FFMIN(first,DIST_MAX) && rec->dist_b >= FFMIN(second,DIST_MAX);
+      ok &= !rec->label_a || ref[rec->label_a*img_size + p] <= rec->dist_a;
+      ok &= !rec->label_b || (rec->label_b != rec->label_a && ref[rec->label_b*img_size + p] <= rec->dist_b);
     }
   }
   
-  p_float* exp_ptr = exponent_kernel_2d->kernel.data_ptr;
-  blabel* x_ptr = exponent_kernel_2d->x_rel.data_ptr;
-  blabel* y_ptr = exponent_kernel_2d->y_rel.data_ptr;
+  av_free(ref);
+  free_distance(&distance_field);
+  free_label(&label_change);
+  return ok;
+}
+
+// a corridor folded into rows of the given width between walls of one
+// region, with a second region at its far end and a third across a wall
+static void fill_serpentine(blabel* lbl,const size_t height,const size_t width,int corridor) {
+  const int band = corridor + 1;
   
-  for(size_t col = 0; col < kernel_size; col++) {
-    for(size_t k = 0; k < kernel_size; k++) {
-      *exp_ptr = exponent_kernel.data_ptr[k]*exponent_kernel.data_ptr[col];
-      *x_ptr = k - mid_point + 1;
-      *y_ptr = col - mid_point + 1;
+  for(size_t y = 0; y < height; y++) {
+    for(size_t x = 0; x < width; x++) {
+      const int row = y / band;
+      const bool wall = y % band == corridor;
+      // openings alternate between the right and the left end
+      const bool open = row & 1 ? x < (size_t)corridor : x >= width - corridor;
       
-      exp_ptr++;
-      x_ptr++;
-      y_ptr++;
+      lbl[y*width + x] = wall && !open ? 2 : 1;
     }
   }
   
-  p_float sum = 0.0f;
-  
-  for(size_t k = 0; k < exponent_kernel_2d->size; k++) {
-    sum += exponent_kernel_2d->kernel.data_ptr[k];
-  }
+  for(size_t y = height - corridor; y < height; y++)
+    for(size_t x = 0; x < 2; x++)
+      lbl[y*width + x] = 3;
   
-  for(size_t k = 0; k < exponent_kernel_2d->size; k++) {
-    exponent_kernel_2d->kernel.data_ptr[k] /= sum;
+  lbl[(height/2)*width + width/2] = 4;
+}
+
+enum TestPattern {
+  Pattern_HGRAD,
+  Pattern_VGRAD,
+  Pattern_DGRAD,
+  Pattern_RADIAL,
+  Pattern_BLOCKS,
+  Pattern_DEEP,
+  Pattern_NB
+};
+
+static const char *const pattern_name[Pattern_NB] = {
+  "hgrad", "vgrad", "dgrad", "radial", "blocks", "deep"
+};
+
+static void fill_pattern(pixel* rgb_ptr,const size_t height,const size_t width,enum TestPattern pattern,AVLFG *lfg) {
+  for(size_t y = 0; y < height; y++) {
+    for(size_t x = 0; x < width; x++) {
+      pixel* pel = rgb_ptr + 3*(y*width + x);
+      int dx = (int)x - (int)width/2;
+      int dy = (int)y - (int)height/2;
+      
+      switch(pattern) {
+      case Pattern_HGRAD:
+	pel[0] = pel[1] = pel[2] = 64 + 24*x/width;
+	break;
+      case Pattern_VGRAD:
+	pel[0] = 16;
+	pel[1] = 32 + 8*y/height;
+	pel[2] = 128 + 16*y/height;
+	break;
+      case Pattern_DGRAD:
+	pel[0] = 200 - 20*(x+y)/(width+height);
+	pel[1] = 100 + 10*(x+y)/(width+height);
+	pel[2] = 50;
+	break;
+      case Pattern_RADIAL:
+	pel[0] = pel[1] = 90 + (int)sqrt(dx*dx + dy*dy)/6;
+	pel[2] = 40;
+	break;
+      case Pattern_BLOCKS:
+	if((x%4) == 0 && (y%4) == 0) {
+	  pel[0] = 60 + (av_lfg_get(lfg)%3)*20;
+	  pel[1] = 60;
+	  pel[2] = 60;
+	}
+	else {
+	  memcpy(pel,rgb_ptr + 3*((y & ~3)*width + (x & ~3)),3*sizeof(pixel));
+	}
+	break;
+      case Pattern_DEEP:
+	// steps only above the low byte, which 8-bit packing would merge
+	pel[0] = 0x1000 + 0x100*(8*x/width);
+	pel[1] = 0x80 + 0x100*(4*y/height);
+	pel[2] = 0x3ff;
+	break;
+      default:
+	break;
+      }
+    }
   }
-  // free allocations
-  free_float(&exponent_kernel);
 }
 
-static void filter_exponent(const size_t height,const size_t width,float_list* exp_list, filter_kernel* exponent_kernel_2d) {
-  p_float* exp_ptr = exp_list->data_ptr;
+// labelled patterns and folded corridors against the reference, at the
+// default and the largest spatial_dist
+static int test_distance(AVLFG *lfg) {
+  const size_t width = 64;
+  const size_t height = 48;
+  static const int max_distance[] = { 7*5, 40*5 };
+  pixel_list rgb;
+  label_list block_label;
+  size_t max_label = 0;
+  int ok = 1;
+  
+  allocate_pixel(&rgb,width*height*3);
+  allocate_label(&block_label,width*height);
+  
+  for(int pattern = 0; pattern < Pattern_NB; pattern++) {
+    fill_pattern(rgb.data_ptr,height,width,pattern,lfg);
+    label(rgb.data_ptr,height,width,0,&block_label,&max_label);
+    
+    for(size_t d = 0; d < FF_ARRAY_ELEMS(max_distance); d++)
+      ok &= test_label_distance(block_label.data_ptr,height,width,max_label,max_distance[d],DISTANCE_PASSES,1);
+  }
+  
+  // a corridor folding back every 12 pixels settles within the passes,
+  // one folding back every 4 pixels needs 6 and is left long
+  fill_serpentine(block_label.data_ptr,height,12,3);
+  ok &= test_label_distance(block_label.data_ptr,height,12,4,max_distance[1],DISTANCE_PASSES,1);
   
-  float_list temp_buffer; 
+  fill_serpentine(block_label.data_ptr,height,4,1);
+  ok &= test_label_distance(block_label.data_ptr,height,4,4,max_distance[1],INT_MAX,1);
+  ok &= !test_label_distance(block_label.data_ptr,height,4,4,max_distance[1],DISTANCE_PASSES,1);
+  ok &= test_label_distance(block_label.data_ptr,height,4,4,max_distance[1],DISTANCE_PASSES,0);
   
-  allocate_float(&temp_buffer,exp_list->size);
-  p_float* out_ptr = temp_buffer.data_ptr;
+  free_pixel(&rgb);
+  free_label(&block_label);
+  return ok;
+}
+
+int main(void)
+{
+  static const size_t sizes[][2] = { { 64, 48 }, { 176, 144 }, { 351, 97 } };
+  AVLFG lfg;
+  AVLFG exponent_lfg;
+  int ret = 0;
   
-  size_t exponent_kernel_2d_size = exponent_kernel_2d->size;
-  p_float* ek_ptr = exponent_kernel_2d->kernel.data_ptr;
-  blabel* xd_ptr = exponent_kernel_2d->x_rel.data_ptr;
-  blabel* yd_ptr = exponent_kernel_2d->y_rel.data_ptr;
-  int xr = 0;
-  int yr = 0;
-  size_t height_end = height - 1;
-  size_t width_end = width - 1;
-  p_float wght = 0.0f;
+  av_lfg_init(&lfg,0xdeba4d);
+  av_lfg_init(&exponent_lfg,0xe4b0);
   
-  for(size_t k = 0; k < exponent_kernel_2d_size; k++) {    
-    wght = *ek_ptr;
+  for(size_t s = 0; s < FF_ARRAY_ELEMS(sizes); s++) {
+    const size_t width = sizes[s][0];
+    const size_t height = sizes[s][1];
     
-    for(size_t y = 0; y < height; y++) {
-      p_float* o_ptr = out_ptr + y*width;
+    for(int pattern = 0; pattern < Pattern_NB; pattern++) {
+      pixel_list rgb;
+      label_list block_label;
+      label_list ref_label;
+      label_list sweep_label;
+      size_t max_label = 0;
+      size_t ref_max_label = 0;
+      size_t sweep_max_label = 0;
+      
+      allocate_pixel(&rgb,width*height*3);
+      allocate_label(&block_label,width*height);
+      allocate_label(&ref_label,width*height);
+      allocate_label(&sweep_label,width*height);
       
-      yr = y + *yd_ptr;
+      fill_pattern(rgb.data_ptr,height,width,pattern,&lfg);
       
-      if(yr < 0) {
-	yr = 0;
+      label(rgb.data_ptr,height,width,0,&block_label,&max_label);
+      label_fixpoint(rgb.data_ptr,height,width,&ref_label,&ref_max_label);
+      
+      if(pattern == Pattern_DEEP) {
+	// the legacy sweep packs 8-bit components only
+	printf("%s %zux%zu: %zu labels\n",pattern_name[pattern],width,height,max_label);
+      }
+      else {
+	label_sweep(rgb.data_ptr,height,width,&sweep_label,&sweep_max_label);
+	
+	printf("%s %zux%zu: %zu labels, sweep %zu labels\n",pattern_name[pattern],width,height,max_label,sweep_max_label);
+	
+	if(!label_refines(&sweep_label,sweep_max_label,&block_label)) {
+	  printf("  sweep region split across labels\n");
+	  ret = 1;
+	}
       }
       
-      if(yr > height_end) {
-	yr = height_end;
+      if(max_label != ref_max_label ||
+	 memcmp(block_label.data_ptr,ref_label.data_ptr,block_label.size*sizeof(blabel))) {
+	printf("  labels differ from reference (%zu labels)\n",ref_max_label);
+	ret = 1;
       }
       
-      p_float* e_ptr = exp_ptr + yr*width;
+      // regions crossing slice borders are joined by label_merge()
+      const size_t slice_counts[] = { 2, 7, height };
       
-      for(size_t x = 0; x < width; x++) {
-	xr = x + *xd_ptr;
+      for(size_t c = 0; c < FF_ARRAY_ELEMS(slice_counts); c++) {
+	label_slices(rgb.data_ptr,height,width,0,slice_counts[c],&block_label,&max_label);
 	
-	if(xr < 0) {
-	  xr = 0;
+	if(max_label != ref_max_label ||
+	   memcmp(block_label.data_ptr,ref_label.data_ptr,block_label.size*sizeof(blabel))) {
+	  printf("  labels in %zu slices differ from reference\n",slice_counts[c]);
+	  ret = 1;
 	}
-	
-	if(xr > width_end) {
-	  xr = width_end;
-	}
-	
-	*o_ptr += e_ptr[xr]*wght;
-	o_ptr++;
       }
+      
+      free_pixel(&rgb);
+      free_label(&block_label);
+      free_label(&ref_label);
+      free_label(&sweep_label);
     }
     
-    xd_ptr++;
-    yd_ptr++;
-    ek_ptr++;
+    for(size_t kernel_size = 3; kernel_size <= 9; kernel_size += 2) {
+      int ok = test_filter_exponent(height,width,kernel_size,&exponent_lfg);
+      
+      printf("exponent filter %zux%zu kernel %zu: %s\n",width,height,kernel_size,ok ? "ok" : "mismatch");
+      
+      if(!ok)
+	ret = 1;
+    }
+  }
+  
+  if(!test_weight_table(&exponent_lfg)) {
+    printf("weight table: mismatch\n");
+    ret = 1;
+  }
+  else
+    printf("weight table: ok\n");
+  
+  if(!test_blend(&exponent_lfg)) {
+    printf("blend: mismatch\n");
+    ret = 1;
+  }
+  else
+    printf("blend: ok\n");
+  
+  if(!test_run_length(&exponent_lfg)) {
+    printf("run length: mismatch\n");
+    ret = 1;
+  }
+  else
+    printf("run length: ok\n");
+  
+  if(!test_region_stats()) {
+    printf("region stats: mismatch\n");
+    ret = 1;
+  }
+  else
+    printf("region stats: ok\n");
+  
+  if(!test_distance(&exponent_lfg)) {
+    printf("distance: mismatch\n");
+    ret = 1;
+  }
+  else
+    printf("distance: ok\n");
+  
+  if(!test_tiles(&exponent_lfg)) {
+    printf("tiles: mismatch\n");
+    ret = 1;
   }
+  else
+    printf("tiles: ok\n");
   
-  memcpy(exp_ptr,out_ptr,temp_buffer.size*sizeof(p_float));
+  if(!test_tolerance()) {
+    printf("tolerance: mismatch\n");
+    ret = 1;
+  }
+  else
+    printf("tolerance: ok\n");
   
-  free_float(&temp_buffer);
+  return ret;
 }
 
+#endif
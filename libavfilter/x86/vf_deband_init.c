@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2014 Gary Baugh baughg@tcd.ie
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#include "libavutil/attributes.h"
+#include "libavutil/cpu.h"
+#include "libavutil/x86/asm.h"
+#include "libavutil/x86/cpu.h"
+#include "libavfilter/deband.h"
+
+#if HAVE_SSE2_INLINE
+/* Four symbols per iteration, compared as 32-bit halves against the
+ * broadcast first symbol; the tail is left to the scalar loop. */
+static int run_length_sse2(const uint64_t *symbol, int width)
+{
+    x86_reg x = 1;
+    int mask;
+
+    if (width > 4) {
+        __asm__ volatile(
+            "movq       (%2), %%xmm0            \n"
+            "punpcklqdq %%xmm0, %%xmm0          \n"
+            "1:                                 \n"
+            "movdqu     (%2,%0,8), %%xmm1       \n"
+            "movdqu     16(%2,%0,8), %%xmm2     \n"
+            "pcmpeqd    %%xmm0, %%xmm1          \n"
+            "pcmpeqd    %%xmm0, %%xmm2          \n"
+            "pand       %%xmm2, %%xmm1          \n"
+            "pmovmskb   %%xmm1, %1              \n"
+            "cmp        $0xffff, %1             \n"
+            "jne        2f                      \n"
+            "add        $4, %0                  \n"
+            "cmp        %3, %0                  \n"
+            "jle        1b                      \n"
+            "2:                                 \n"
+            : "+r"(x), "=&r"(mask)
+            : "r"(symbol), "r"((x86_reg)(width - 4))
+            : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2",)
+              "memory"
+        );
+    }
+
+    while (x < width && symbol[x] == symbol[0])
+        x++;
+
+    return x;
+}
+#endif /* HAVE_SSE2_INLINE */
+
+av_cold void ff_deband_init_x86(DebandDSPContext *dsp)
+{
+#if HAVE_SSE2_INLINE
+    int cpu_flags = av_get_cpu_flags();
+
+    if (INLINE_SSE2(cpu_flags)) {
+        dsp->run_length = run_length_sse2;
+    }
+#endif /* HAVE_SSE2_INLINE */
+}
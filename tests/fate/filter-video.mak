@@ -317,6 +317,89 @@ $(FATE_FILTER_VSYNTH-yes): SRC = $(TARGET_PATH)/tests/vsynth1/%02d.pgm
 
 FATE_AVCONV-$(call DEMDEC, IMAGE2, PGMYUV) += $(FATE_FILTER_VSYNTH-yes)
 
+FATE_FILTER_DEBAND-$(CONFIG_DEBAND_FILTER) += fate-filter-deband-label
+fate-filter-deband-label: libavfilter/vf_pixel_label-test$(EXESUF)
+fate-filter-deband-label: CMD = run libavfilter/vf_pixel_label-test
+
+# banded gradients over three quarters of the frame, the vsynth picture in
+# the rest; the dither is seeded, so the output is deterministic
+DEBAND_YUV = geq=lum=if(gt(X\,W*3/4)\,lum(X\,Y)\,48+X*40/W+Y*8/H):cb=if(gt(X\,W*3/4)\,cb(X\,Y)\,128):cr=if(gt(X\,W*3/4)\,cr(X\,Y)\,120+Y*8/H)
+DEBAND_ALTERNATE = geq=lum=if(gt(X\,W*3/4)+mod(N\,2)\,lum(X\,Y)\,48+X*40/W+Y*8/H):cb=if(gt(X\,W*3/4)+mod(N\,2)\,cb(X\,Y)\,128):cr=if(gt(X\,W*3/4)+mod(N\,2)\,cr(X\,Y)\,120+Y*8/H)
+DEBAND_RGB = format=gbrp,geq=r=if(gt(X\,W*3/4)\,r(X\,Y)\,40+X*40/W):g=if(gt(X\,W*3/4)\,g(X\,Y)\,60+Y*30/H):b=if(gt(X\,W*3/4)\,b(X\,Y)\,90+(X+Y)*30/(W+H))
+
+FATE_FILTER_DEBAND_VSYNTH-$(CONFIG_DEBAND_FILTER) += fate-filter-deband
+fate-filter-deband: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf deband
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-gradient
+fate-filter-deband-gradient: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_YUV),deband"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-options
+fate-filter-deband-options: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_YUV),deband=colour_dist=8:spatial_dist=20:kernel_size=5:dither_strength=0.5:seed=7"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-colour_tol
+fate-filter-deband-colour_tol: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_YUV),deband=colour_tol=2"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-analysis_scale
+fate-filter-deband-analysis_scale: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_YUV),deband=analysis_scale=2"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-stripe_rows
+fate-filter-deband-stripe_rows: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_YUV),deband=stripe_rows=40"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-temporal
+fate-filter-deband-temporal: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_YUV),deband=temporal=1"
+
+# odd frames are left as the vsynth picture and passed through by the detector
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-bypass
+fate-filter-deband-bypass: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 6 -vf "$(DEBAND_ALTERNATE),deband=bypass=0.3"
+
+# same frames as the bypass test, skipped ones keep their place in the pipeline
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-pipeline
+fate-filter-deband-pipeline: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 6 -vf "$(DEBAND_ALTERNATE),deband=bypass=0.3:pipeline=3"
+
+# pass 2 reads the scores pass 1 wrote instead of detecting again
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-pass1
+fate-filter-deband-pass1: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 6 -vf "$(DEBAND_ALTERNATE),deband=bypass=0.3:pass=1:analysis_file=$(TARGET_PATH)/tests/data/fate/deband-analysis.bin"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-pass2
+fate-filter-deband-pass2: fate-filter-deband-pass1
+fate-filter-deband-pass2: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 6 -vf "$(DEBAND_ALTERNATE),deband=bypass=0.3:pass=2:analysis_file=$(TARGET_PATH)/tests/data/fate/deband-analysis.bin"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-yuv420p10
+fate-filter-deband-yuv420p10: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_YUV),format=yuv420p10le,deband=colour_tol=1:analysis_scale=2:stripe_rows=64"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-rgb24
+fate-filter-deband-rgb24: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_RGB),format=rgb24,deband=seed=3"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-fixed_point
+fate-filter-deband-fixed_point: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_RGB),format=rgb24,deband=fixed_point=1"
+
+FATE_FILTER_DEBAND_GRADIENT += fate-filter-deband-gbrp
+fate-filter-deband-gbrp: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_RGB),deband=colour_tol=1:stripe_rows=40:temporal=1"
+
+FATE_FILTER_DEBAND_VSYNTH-$(call ALLYES, DEBAND_FILTER GEQ_FILTER FORMAT_FILTER) += $(FATE_FILTER_DEBAND_GRADIENT)
+
+# the commands at the third frame rebuild the kernel, the weights and the
+# stripe buffers between frames in flight
+FATE_FILTER_DEBAND_VSYNTH-$(call ALLYES, DEBAND_FILTER GEQ_FILTER SENDCMD_FILTER) += fate-filter-deband-command
+fate-filter-deband-command: tests/data/filtergraphs/deband-command
+fate-filter-deband-command: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -filter_script $(TARGET_PATH)/tests/data/filtergraphs/deband-command
+
+# pass 2 takes spatial_dist and kernel_size as the commands left them in pass 1
+FATE_FILTER_DEBAND_VSYNTH-$(call ALLYES, DEBAND_FILTER GEQ_FILTER SENDCMD_FILTER) += fate-filter-deband-pass1-command fate-filter-deband-pass2-command
+fate-filter-deband-pass1-command: tests/data/filtergraphs/deband-pass1-command
+fate-filter-deband-pass1-command: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -filter_script $(TARGET_PATH)/tests/data/filtergraphs/deband-pass1-command
+fate-filter-deband-pass2-command: fate-filter-deband-pass1-command
+fate-filter-deband-pass2-command: CMD = framecrc -c:v pgmyuv -i $(SRC) -vframes 5 -vf "$(DEBAND_YUV),deband=pass=2:analysis_file=$(TARGET_PATH)/tests/data/fate/deband-command-analysis.bin"
+
+$(FATE_FILTER_DEBAND_VSYNTH-yes): $(VREF)
+$(FATE_FILTER_DEBAND_VSYNTH-yes): SRC = $(TARGET_PATH)/tests/vsynth1/%02d.pgm
+
+FATE_FILTER_DEBAND-$(call DEMDEC, IMAGE2, PGMYUV) += $(FATE_FILTER_DEBAND_VSYNTH-yes)
+
+fate-filter-deband-all: $(FATE_FILTER_DEBAND-yes)
+
+FATE-yes += $(FATE_FILTER_DEBAND-yes)
+
 #
 # Metadata tests
 #
@@ -340,6 +423,6 @@ fate-filter-metadata-ebur128: CMD = run $(FILTER_METADATA_COMMAND) "amovie='$(SR
 
 FATE_SAMPLES_FFPROBE += $(FATE_METADATA_FILTER-yes)
 
-fate-vfilter: $(FATE_FILTER-yes) $(FATE_FILTER_VSYNTH-yes)
+fate-vfilter: $(FATE_FILTER-yes) $(FATE_FILTER_VSYNTH-yes) $(FATE_FILTER_DEBAND-yes)
 
 fate-filter: fate-afilter fate-vfilter $(FATE_METADATA_FILTER-yes)
@@ -0,0 +1,289 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Time the stages of the deband filter on synthetic banded gradients or
+ * on a raw rgb24 frame:
+ *     make tools/deband_bench
+ *     tools/deband_bench -r 20 -s 1920x1080 -o colour_tol=1
+ *     tools/deband_bench -r 20 -s 1920x1080 -o pipeline=4
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/frame.h"
+#include "libavutil/lfg.h"
+#include "libavutil/parseutils.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/time.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+
+#if HAVE_UNISTD_H
+#include <unistd.h> /* for getopt */
+#endif
+#if !HAVE_GETOPT
+#include "compat/getopt.c"
+#endif
+
+/* stages reported by the filter as lavfi.deband.time.* metadata */
+static const char *const stage_name[] = {
+    "detect", "ingest", "label", "distance", "stat", "exponent", "blend"
+};
+
+#define NB_STAGES FF_ARRAY_ELEMS(stage_name)
+
+static const struct {
+    const char *name;
+    int width, height;
+} sizes[] = {
+    { "480p",  854,  480 },
+    { "720p",  1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "2160p", 3840, 2160 },
+    { "4320p", 7680, 4320 },
+};
+
+static const char *filter_options = "";
+static const char *pix_fmt_name;
+static const char *input_name;
+static unsigned nb_runs = 10;
+static int nb_threads = 1;
+
+static void fatal_error(const char *tag)
+{
+    av_log(NULL, AV_LOG_ERROR, "Fatal error: %s\n", tag);
+    exit(1);
+}
+
+/**
+ * Diagonal gradient quantised to 8 bits in a few dozen bands, with a
+ * square of seeded noise standing in for texture.
+ */
+static void fill_gradient(AVFrame *frame, AVLFG *lfg)
+{
+    const int w = frame->width, h = frame->height;
+    int x, y;
+
+    for (y = 0; y < h; y++) {
+        uint8_t *row = frame->data[0] + y * frame->linesize[0];
+
+        for (x = 0; x < w; x++) {
+            const int v = 40 + 48 * (x + y) / (w + h);
+
+            row[3 * x]     = v;
+            row[3 * x + 1] = v + 8;
+            row[3 * x + 2] = 2 * v;
+
+            if (x >= w / 8 && x < w / 4 && y >= h / 8 && y < h / 4)
+                row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = av_lfg_get(lfg) & 0xff;
+        }
+    }
+}
+
+static void read_input(AVFrame *frame)
+{
+    FILE *f = fopen(input_name, "rb");
+    int y;
+
+    if (!f)
+        fatal_error("cannot open input");
+    for (y = 0; y < frame->height; y++)
+        if (fread(frame->data[0] + y * frame->linesize[0], 3, frame->width, f) != frame->width)
+            fatal_error("input shorter than one frame");
+    fclose(f);
+}
+
+static AVFilterGraph *init_graph(int width, int height,
+                                 AVFilterContext **src, AVFilterContext **sink)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *deband;
+    char args[256];
+
+    if (!graph)
+        fatal_error("out of memory");
+    graph->nb_threads = nb_threads;
+
+    snprintf(args, sizeof(args),
+             "video_size=%dx%d:pix_fmt=%d:time_base=1/25:pixel_aspect=1/1",
+             width, height, AV_PIX_FMT_RGB24);
+    if (avfilter_graph_create_filter(src, avfilter_get_by_name("buffer"), "in",
+                                     args, NULL, graph) < 0 ||
+        avfilter_graph_create_filter(sink, avfilter_get_by_name("buffersink"), "out",
+                                     NULL, NULL, graph) < 0 ||
+        avfilter_graph_create_filter(&deband, avfilter_get_by_name("deband"), "deband",
+                                     filter_options, NULL, graph) < 0)
+        fatal_error("cannot create filters");
+
+    if (pix_fmt_name) {
+        AVFilterContext *format;
+
+        if (avfilter_graph_create_filter(&format, avfilter_get_by_name("format"), "format",
+                                         pix_fmt_name, NULL, graph) < 0 ||
+            avfilter_link(*src, 0, format, 0) < 0 ||
+            avfilter_link(format, 0, deband, 0) < 0)
+            fatal_error("cannot create format filter");
+    } else if (avfilter_link(*src, 0, deband, 0) < 0) {
+        fatal_error("cannot link filters");
+    }
+
+    if (avfilter_link(deband, 0, *sink, 0) < 0 ||
+        avfilter_graph_config(graph, NULL) < 0)
+        fatal_error("cannot configure filter graph");
+
+    return graph;
+}
+
+static void run_size(const char *name, int width, int height, AVLFG *lfg)
+{
+    AVFilterContext *src, *sink;
+    AVFilterGraph *graph = init_graph(width, height, &src, &sink);
+    AVFrame *in  = av_frame_alloc();
+    AVFrame *out = av_frame_alloc();
+    int64_t stage_time[NB_STAGES] = { 0 };
+    int64_t total, t0;
+    double scale;
+    unsigned run, s;
+
+    if (!in || !out)
+        fatal_error("out of memory");
+    in->format = AV_PIX_FMT_RGB24;
+    in->width  = width;
+    in->height = height;
+    if (av_frame_get_buffer(in, 32) < 0)
+        fatal_error("out of memory");
+
+    if (input_name)
+        read_input(in);
+    else
+        fill_gradient(in, lfg);
+
+    // frames are fed ahead of the ones taken out, the filter may keep
+    // several in flight with its pipeline option
+    t0 = av_gettime();
+    for (run = 0; run <= nb_runs; run++) {
+        int ret;
+
+        in->pts = run;
+        if (av_buffersrc_add_frame_flags(src, run < nb_runs ? in : NULL,
+                                         AV_BUFFERSRC_FLAG_KEEP_REF) < 0)
+            fatal_error("filtering failed");
+
+        while ((ret = av_buffersink_get_frame(sink, out)) >= 0) {
+            AVDictionaryEntry *e;
+
+            for (s = 0; s < NB_STAGES; s++) {
+                char key[64];
+                snprintf(key, sizeof(key), "lavfi.deband.time.%s", stage_name[s]);
+                if ((e = av_dict_get(av_frame_get_metadata(out), key, NULL, 0)))
+                    stage_time[s] += strtoll(e->value, NULL, 10);
+            }
+            av_frame_unref(out);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            fatal_error("filtering failed");
+    }
+    total = av_gettime() - t0;
+
+    scale = 1000.0 / ((double)width * height * nb_runs);
+    printf("%-6s %5dx%-5d", name, width, height);
+    for (s = 0; s < NB_STAGES; s++)
+        printf(" %s %6.2f", stage_name[s], stage_time[s] * scale);
+    printf(" total %6.2f ns/pixel\n", total * scale);
+    fflush(stdout);
+
+    av_frame_free(&in);
+    av_frame_free(&out);
+    avfilter_graph_free(&graph);
+}
+
+static void usage(void)
+{
+    printf("Usage: deband_bench [-o opts] [-p pix_fmt] [-r runs] [-t threads]\n"
+           "                    [-s size] [-i input.rgb]\n"
+           "Time the deband filter stages in ns per pixel.\n"
+           "  -o  deband filter options\n"
+           "  -p  convert the input to this pixel format first\n"
+           "  -r  frames per size (default 10)\n"
+           "  -t  filter threads (default 1)\n"
+           "  -s  frame size, all of 480p to 4320p if omitted\n"
+           "  -i  raw rgb24 frame to use instead of the gradient; needs -s\n");
+}
+
+int main(int argc, char **argv)
+{
+    int width = 0, height = 0;
+    AVLFG lfg;
+    int opt;
+    unsigned i;
+
+    while ((opt = getopt(argc, argv, "ho:p:r:t:s:i:")) != -1) {
+        switch (opt) {
+        case 'o':
+            filter_options = optarg;
+            break;
+        case 'p':
+            if (av_get_pix_fmt(optarg) == AV_PIX_FMT_NONE)
+                fatal_error("unknown pixel format");
+            pix_fmt_name = optarg;
+            break;
+        case 'r':
+            nb_runs = strtol(optarg, NULL, 0);
+            if (!nb_runs)
+                fatal_error("invalid run count");
+            break;
+        case 't':
+            nb_threads = strtol(optarg, NULL, 0);
+            break;
+        case 's':
+            if (av_parse_video_size(&width, &height, optarg) < 0)
+                fatal_error("invalid size");
+            break;
+        case 'i':
+            input_name = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    if (input_name && !width)
+        fatal_error("raw input needs -s");
+
+    avfilter_register_all();
+    av_lfg_init(&lfg, 0xdeba4d);
+
+    if (width) {
+        run_size("", width, height, &lfg);
+    } else {
+        for (i = 0; i < FF_ARRAY_ELEMS(sizes); i++)
+            run_size(sizes[i].name, sizes[i].width, sizes[i].height, &lfg);
+    }
+
+    return 0;
+}